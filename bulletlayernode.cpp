@@ -0,0 +1,212 @@
+#include "bulletlayernode.h"
+
+#include <algorithm>
+#include <cstddef>
+
+static const char *vertexShader =
+        "attribute vec2 aV;\n"
+        "attribute vec2 aP;\n"
+        "attribute vec4 aC;\n"
+        "uniform mat4 m;\n"
+        "varying vec4 vC;\n"
+        "void main() {\n"
+        "    gl_Position = m * vec4(aP + aV, 0, 1);\n"
+        "    vC = aC;\n"
+        "}\n";
+
+static const char *fragmentShader =
+        "#ifdef GL_ES\n"
+        "precision mediump float;\n"
+        "#endif\n"
+        "varying vec4 vC;\n"
+        "void main() {\n"
+        "    gl_FragColor = vC;\n"
+        "}\n";
+
+// Same size as the RectangleNodes they used to be
+static const float bulletSize = 6;
+
+static const vec2 quad[] = {
+    vec2(-bulletSize / 2, -bulletSize / 2),
+    vec2(bulletSize / 2, -bulletSize / 2),
+    vec2(-bulletSize / 2, bulletSize / 2),
+    vec2(bulletSize / 2, bulletSize / 2),
+};
+
+// The quad as two triangles, for drawing without instancing
+static const int quadTriangles[] = { 0, 1, 2, 2, 1, 3 };
+
+// glVertexAttribDivisor() needs OpenGL 3.3, OpenGL ES 2.0 doesn't have it
+static bool hasInstancing()
+{
+#ifdef RENGINE_OPENGL_DESKTOP
+    return GLEW_VERSION_3_3;
+#else
+    return false;
+#endif
+}
+
+BulletLayerNode::BulletLayerNode()
+{
+    std::vector<const char *> attrsV;
+    attrsV.push_back("aV");
+    attrsV.push_back("aP");
+    attrsV.push_back("aC");
+
+    m_shaderProgram.initialize(vertexShader, fragmentShader, attrsV);
+    m_shaderProgram.matrix = m_shaderProgram.resolve("m");
+
+    m_instanced = hasInstancing();
+    if (m_instanced) {
+        glGenBuffers(1, &m_quadBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_quadBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    glGenBuffers(1, &m_instanceBuffer);
+}
+
+BulletLayerNode::~BulletLayerNode()
+{
+    if (m_quadBuffer) {
+        glDeleteBuffers(1, &m_quadBuffer);
+    }
+    glDeleteBuffers(1, &m_instanceBuffer);
+}
+
+void BulletLayerNode::setOwnerColor(const int owner, const vec4 &color)
+{
+    if (owner >= int(m_ownerColors.size())) {
+        m_ownerColors.resize(owner + 1, {{ 255, 255, 255, 255 }});
+    }
+    m_ownerColors[owner] = {{
+        uint8_t(color.x * color.w * 255),
+        uint8_t(color.y * color.w * 255),
+        uint8_t(color.z * color.w * 255),
+        uint8_t(color.w * 255),
+    }};
+}
+
+void BulletLayerNode::sync(const vector<SceneState::BulletState> &bullets)
+{
+    // The instances are what is shown right now, which is where the ones
+    // still here move from
+    swap(m_previousIndices, m_indices);
+    m_indices.clear();
+
+    m_previousPositions.resize(m_instances.size());
+    for (size_t i=0; i<m_instances.size(); i++) {
+        m_previousPositions[i] = m_instances[i].position;
+    }
+
+    m_bullets.resize(bullets.size());
+    for (size_t i=0; i<bullets.size(); i++) {
+        const SceneState::BulletState &state = bullets[i];
+        Bullet &bullet = m_bullets[i];
+        bullet.owner = state.owner;
+        bullet.to = vec2(state.position.x, state.position.y);
+
+        const unordered_map<int, size_t>::const_iterator previous = m_previousIndices.find(state.id);
+        if (previous != m_previousIndices.end()) {
+            bullet.from = m_previousPositions[previous->second];
+        } else {
+            bullet.from = bullet.to;
+        }
+
+        m_indices[state.id] = i;
+    }
+
+    m_instances.resize(m_bullets.size());
+    for (size_t i=0; i<m_bullets.size(); i++) {
+        Instance &instance = m_instances[i];
+        instance.position = m_bullets[i].from;
+
+        const int owner = m_bullets[i].owner;
+        if (owner >= 0 && owner < int(m_ownerColors.size())) {
+            std::copy(m_ownerColors[owner].begin(), m_ownerColors[owner].end(), instance.color);
+        } else {
+            std::fill(instance.color, instance.color + 4, 255);
+        }
+    }
+    m_dirty = true;
+}
+
+void BulletLayerNode::interpolate(const float progress)
+{
+    for (size_t i=0; i<m_bullets.size(); i++) {
+        const Bullet &bullet = m_bullets[i];
+        m_instances[i].position = bullet.from + (bullet.to - bullet.from) * progress;
+    }
+    m_dirty = true;
+}
+
+void BulletLayerNode::render(const mat4 &proj)
+{
+    if (m_instances.empty()) {
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer);
+    if (m_dirty) {
+        // Orphaned so the upload doesn't wait for last frame's draw, and only
+        // reallocated when it has to grow
+        if (m_instances.size() > m_instanceCapacity) {
+            m_instanceCapacity = std::max(m_instances.size(), m_instanceCapacity * 2);
+        }
+        if (m_instanced) {
+            glBufferData(GL_ARRAY_BUFFER, m_instanceCapacity * sizeof(Instance), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, m_instances.size() * sizeof(Instance), m_instances.data());
+        } else {
+            m_vertices.resize(m_instances.size() * 6);
+            for (size_t i=0; i<m_instances.size(); i++) {
+                for (int j=0; j<6; j++) {
+                    Vertex &vertex = m_vertices[i * 6 + j];
+                    vertex.corner = quad[quadTriangles[j]];
+                    vertex.instance = m_instances[i];
+                }
+            }
+            glBufferData(GL_ARRAY_BUFFER, m_instanceCapacity * 6 * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, m_vertices.size() * sizeof(Vertex), m_vertices.data());
+        }
+        m_dirty = false;
+    }
+
+    glUseProgram(m_shaderProgram.id());
+
+    for (int i=0; i<m_shaderProgram.attributeCount(); ++i) {
+        glEnableVertexAttribArray(i);
+    }
+
+    glUniformMatrix4fv(m_shaderProgram.matrix, 1, true, proj.m);
+
+    if (m_instanced) {
+#ifdef RENGINE_OPENGL_DESKTOP
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), reinterpret_cast<const void*>(offsetof(Instance, position)));
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance), reinterpret_cast<const void*>(offsetof(Instance, color)));
+        glVertexAttribDivisor(1, 1);
+        glVertexAttribDivisor(2, 1);
+
+        glBindBuffer(GL_ARRAY_BUFFER, m_quadBuffer);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, m_instances.size());
+
+        // Not left on for whatever draws next
+        glVertexAttribDivisor(1, 0);
+        glVertexAttribDivisor(2, 0);
+#endif
+    } else {
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<const void*>(offsetof(Vertex, corner)));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<const void*>(offsetof(Vertex, instance) + offsetof(Instance, position)));
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), reinterpret_cast<const void*>(offsetof(Vertex, instance) + offsetof(Instance, color)));
+
+        glDrawArrays(GL_TRIANGLES, 0, m_vertices.size());
+    }
+
+    for (int i=1; i<m_shaderProgram.attributeCount(); ++i) {
+        glDisableVertexAttribArray(i);
+    }
+
+    glUseProgram(0);
+}
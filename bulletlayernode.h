@@ -0,0 +1,80 @@
+#ifndef BULLETLAYERNODE_H
+#define BULLETLAYERNODE_H
+
+#include "simulation.h"
+
+#include <rengine.h>
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+
+using namespace rengine;
+using namespace std;
+
+// Draws every bullet with one instanced draw of a small square, from an
+// instance buffer that is refilled each frame. Without instancing (OpenGL ES
+// 2.0, or OpenGL before 3.3) the squares are expanded into two triangles each
+// in that buffer instead. Bullets are kept in plain arrays instead of being
+// nodes, so how many there can be is only a question of memory.
+class BulletLayerNode : public RenderNode
+{
+public:
+    BulletLayerNode();
+    ~BulletLayerNode();
+
+    void render(const mat4 &proj) override;
+
+    // Bullets are colored after the player that fired them
+    void setOwnerColor(const int owner, const vec4 &color);
+
+    // Bullets that were here before move from where they are shown to the new
+    // position, the new ones start there
+    void sync(const vector<SceneState::BulletState> &bullets);
+
+    // 0 is where they were when synced, 1 is the synced state
+    void interpolate(const float progress);
+
+    size_t bulletCount() const { return m_bullets.size(); }
+
+private:
+    struct Bullet {
+        int owner;
+        vec2 from;
+        vec2 to;
+    };
+
+    struct Instance {
+        vec2 position;
+        // Premultiplied
+        uint8_t color[4];
+    };
+
+    // Without instancing
+    struct Vertex {
+        vec2 corner;
+        Instance instance;
+    };
+
+    struct : public OpenGLShaderProgram {
+        int matrix;
+    } m_shaderProgram;
+
+    bool m_instanced = false;
+    GLuint m_quadBuffer = 0;
+    GLuint m_instanceBuffer;
+    size_t m_instanceCapacity = 0;
+    bool m_dirty = false;
+
+    vector<Bullet> m_bullets;
+    vector<Instance> m_instances;
+    vector<Vertex> m_vertices;
+    vector<array<uint8_t, 4>> m_ownerColors;
+
+    // Id to index into m_bullets, as of the last sync and the one before
+    unordered_map<int, size_t> m_indices;
+    unordered_map<int, size_t> m_previousIndices;
+    vector<vec2> m_previousPositions;
+};
+
+#endif // BULLETLAYERNODE_H
@@ -0,0 +1,194 @@
+#include "bulletstore.h"
+
+#include "player.h"
+#include "world.h"
+
+#include <algorithm>
+#include <cassert>
+
+BulletHandle BulletStore::fire(Player *owner, const int id, const Vec2 &origin, const Vec2 &target, const bool startedInside)
+{
+    State state;
+    state.id = id;
+    state.owner = owner;
+    state.origin = origin;
+    state.position = origin;
+    state.target = target;
+    state.startedInside = startedInside;
+
+    const float distance = (target - origin).length();
+    if (distance > 0) {
+        state.velocity = (target - origin) * (speed / distance);
+        state.duration = distance / speed;
+    }
+
+    return add(state);
+}
+
+BulletHandle BulletStore::add(const State &state)
+{
+    uint32_t slot;
+    if (!m_freeSlots.empty()) {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else {
+        slot = m_indices.size();
+        m_indices.push_back(0);
+        m_generations.push_back(0);
+    }
+    m_indices[slot] = m_ids.size();
+
+    m_ids.push_back(state.id);
+    m_owners.push_back(state.owner);
+    m_origins.push_back(state.origin);
+    m_velocities.push_back(state.velocity);
+    m_positions.push_back(state.position);
+    m_targets.push_back(state.target);
+    m_flightTimes.push_back(state.flightTime);
+    m_durations.push_back(state.duration);
+    m_startedInside.push_back(state.startedInside);
+    m_flying.push_back(state.flying);
+    m_slots.push_back(slot);
+
+    BulletHandle handle;
+    handle.slot = slot;
+    handle.generation = m_generations[slot];
+    return handle;
+}
+
+bool BulletStore::contains(const BulletHandle &handle) const
+{
+    return handle.slot < m_generations.size() && m_generations[handle.slot] == handle.generation;
+}
+
+void BulletStore::remove(const BulletHandle &handle)
+{
+    if (!contains(handle)) {
+        return;
+    }
+    removeAt(m_indices[handle.slot]);
+}
+
+void BulletStore::removeAt(const size_t index)
+{
+    const uint32_t slot = m_slots[index];
+    m_generations[slot]++;
+    m_freeSlots.push_back(slot);
+
+    const size_t last = m_ids.size() - 1;
+    if (index != last) {
+        m_ids[index] = m_ids[last];
+        m_owners[index] = m_owners[last];
+        m_origins[index] = m_origins[last];
+        m_velocities[index] = m_velocities[last];
+        m_positions[index] = m_positions[last];
+        m_targets[index] = m_targets[last];
+        m_flightTimes[index] = m_flightTimes[last];
+        m_durations[index] = m_durations[last];
+        m_startedInside[index] = m_startedInside[last];
+        m_flying[index] = m_flying[last];
+        m_slots[index] = m_slots[last];
+        m_indices[m_slots[index]] = index;
+    }
+
+    m_ids.pop_back();
+    m_owners.pop_back();
+    m_origins.pop_back();
+    m_velocities.pop_back();
+    m_positions.pop_back();
+    m_targets.pop_back();
+    m_flightTimes.pop_back();
+    m_durations.pop_back();
+    m_startedInside.pop_back();
+    m_flying.pop_back();
+    m_slots.pop_back();
+}
+
+void BulletStore::clear()
+{
+    while (!m_ids.empty()) {
+        removeAt(m_ids.size() - 1);
+    }
+}
+
+BulletStore::State BulletStore::state(const size_t index) const
+{
+    State state;
+    state.id = m_ids[index];
+    state.owner = m_owners[index];
+    state.origin = m_origins[index];
+    state.velocity = m_velocities[index];
+    state.position = m_positions[index];
+    state.target = m_targets[index];
+    state.flightTime = m_flightTimes[index];
+    state.duration = m_durations[index];
+    state.startedInside = m_startedInside[index];
+    state.flying = m_flying[index];
+    return state;
+}
+
+void BulletStore::update(World *world, const float dt)
+{
+    assert(world);
+
+    const size_t count = m_ids.size();
+    for (size_t i=0; i<count; i++) {
+        if (!m_flying[i]) {
+            continue;
+        }
+
+        const Vec2 from = m_positions[i];
+        m_flightTimes[i] = std::min(m_flightTimes[i] + dt, m_durations[i]);
+        const Vec2 to = m_flightTimes[i] >= m_durations[i] ? m_targets[i] : m_origins[i] + m_velocities[i] * m_flightTimes[i];
+        m_positions[i] = to;
+
+        if (m_flightTimes[i] >= m_durations[i]) {
+            m_flying[i] = false;
+        }
+
+        shared_ptr<Player> target;
+        const float obstacle = world->obstacleHit(from, to, m_startedInside[i]);
+        const float player = world->playerHit(from, to, m_owners[i], &target);
+
+        if (obstacle >= 0 && (player < 0 || obstacle <= player)) {
+            m_positions[i] = from + (to - from) * obstacle;
+            m_flying[i] = false;
+            continue;
+        }
+
+        if (player < 0) {
+            continue;
+        }
+
+        m_positions[i] = from + (to - from) * player;
+        m_flying[i] = false;
+        m_hits.push_back(move(target));
+    }
+
+    // Nobody dies before every bullet has moved, so what happens does not
+    // depend on where the bullets are in the arrays
+    for (const shared_ptr<Player> &player : m_hits) {
+        player->die();
+    }
+    m_hits.clear();
+
+    // From the back, so what gets swapped in has already been looked at
+    for (size_t i=count; i-- > 0;) {
+        if (!m_flying[i]) {
+            removeAt(i);
+        }
+    }
+}
+
+json::JSON Bullet::serializeState() const
+{
+    json::JSON state;
+
+    state["id"] = id;
+    state["x"] = position().x;
+    state["y"] = position().y;
+    state["target_x"] = target().x;
+    state["target_y"] = target().y;
+
+    return state;
+}
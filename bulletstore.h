@@ -0,0 +1,122 @@
+#ifndef BULLETSTORE_H
+#define BULLETSTORE_H
+
+#include "geometry.h"
+
+#include <SimpleJSON/json.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Player;
+class World;
+
+using namespace std;
+
+// Refers to a bullet in a BulletStore. When the bullet is removed its slot gets
+// a new generation, so an old handle never finds whoever gets the slot next.
+struct BulletHandle
+{
+    uint32_t slot = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const BulletHandle &other) const { return slot == other.slot && generation == other.generation; }
+    bool operator!=(const BulletHandle &other) const { return !(*this == other); }
+};
+
+// All the bullets in a World, one array per field, so a tick is one pass over
+// a few packed arrays instead of a walk through every player's set of heap
+// allocated bullets. Removing swaps the last bullet into the hole, so the order
+// in the arrays is not the order they were fired in.
+class BulletStore
+{
+public:
+    static constexpr float speed = 750.f;
+
+    // Everything about one bullet, for firing and for replays
+    struct State {
+        int id = 0;
+        Player *owner = nullptr;
+        Vec2 origin;
+        Vec2 velocity;
+        Vec2 position;
+        Vec2 target;
+        float flightTime = 0;
+        float duration = 0;
+        bool startedInside = false;
+        bool flying = true;
+    };
+
+    // From owner towards target, at speed
+    BulletHandle fire(Player *owner, const int id, const Vec2 &origin, const Vec2 &target, const bool startedInside);
+    BulletHandle add(const State &state);
+
+    void remove(const BulletHandle &handle);
+    bool contains(const BulletHandle &handle) const;
+    void clear();
+
+    // Moves every bullet dt seconds further along its path, kills whoever
+    // they hit, and removes the ones that stopped
+    void update(World *world, const float dt);
+
+    size_t size() const { return m_ids.size(); }
+
+    // Where in the arrays, until the next add or remove
+    size_t indexOf(const BulletHandle &handle) const { return m_indices[handle.slot]; }
+
+    int id(const size_t index) const { return m_ids[index]; }
+    Player *owner(const size_t index) const { return m_owners[index]; }
+    Vec2 position(const size_t index) const { return m_positions[index]; }
+    Vec2 target(const size_t index) const { return m_targets[index]; }
+    State state(const size_t index) const;
+
+private:
+    void removeAt(const size_t index);
+
+    // Per bullet
+    vector<int> m_ids;
+    vector<Player*> m_owners;
+    vector<Vec2> m_origins;
+    vector<Vec2> m_velocities;
+    vector<Vec2> m_positions;
+    vector<Vec2> m_targets;
+    vector<float> m_flightTimes;
+    vector<float> m_durations;
+    vector<uint8_t> m_startedInside;
+    vector<uint8_t> m_flying;
+    vector<uint32_t> m_slots;
+
+    // Per slot
+    vector<uint32_t> m_indices;
+    vector<uint32_t> m_generations;
+    vector<uint32_t> m_freeSlots;
+
+    // Who was hit this update, reused
+    vector<shared_ptr<Player>> m_hits;
+};
+
+// One bullet as it is in a BulletStore right now, for reading it out
+class Bullet
+{
+public:
+    const int id;
+
+    Bullet(const BulletStore &store, const size_t index) :
+        id(store.id(index)),
+        m_store(store),
+        m_index(index)
+    {}
+
+    Player *owner() const { return m_store.owner(m_index); }
+    Vec2 position() const { return m_store.position(m_index); }
+    Vec2 target() const { return m_store.target(m_index); }
+
+    json::JSON serializeState() const;
+
+private:
+    const BulletStore &m_store;
+    const size_t m_index;
+};
+
+#endif // BULLETSTORE_H
@@ -0,0 +1,101 @@
+#include "commandparser.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+void Command::setText(const string_view &value)
+{
+    const size_t length = min(value.size(), sizeof(text) - 1);
+    memcpy(text, value.data(), length);
+    text[length] = '\0';
+}
+
+// Splits off the next space separated token, empty when there are no more
+static string_view nextToken(string_view *line)
+{
+    const size_t start = line->find_first_not_of(' ');
+    if (start == string_view::npos) {
+        *line = string_view();
+        return string_view();
+    }
+    line->remove_prefix(start);
+
+    const size_t end = min(line->find(' '), line->size());
+    const string_view token = line->substr(0, end);
+    line->remove_prefix(end);
+    return token;
+}
+
+template<typename T>
+static bool parseNumber(const string_view &token, T *value)
+{
+    if (token.empty()) {
+        return false;
+    }
+    const char *end = token.data() + token.size();
+    const from_chars_result result = from_chars(token.data(), end, *value);
+    return result.ec == errc() && result.ptr == end;
+}
+
+bool CommandParser::parseLine(const char *data, size_t length, Command *command)
+{
+    if (length > 0 && data[length - 1] == '\r') {
+        length--;
+    }
+    string_view line(data, length);
+
+    const string_view name = nextToken(&line);
+    if (name.empty()) {
+        return false;
+    }
+
+    command->type = commandType(name);
+    switch(command->type) {
+    case Command::Invalid:
+        cerr << "unknown command '" << name << "'" << endl;
+        return false;
+    case Command::Name:
+    case Command::Protocol: {
+        const string_view argument = nextToken(&line);
+        if (argument.empty() || !nextToken(&line).empty()) {
+            cerr << "Invalid " << name << ", expected one argument" << endl;
+            return false;
+        }
+        command->setText(argument);
+        break;
+    }
+    case Command::PointAt:
+        if (!parseNumber(nextToken(&line), &command->x) || !parseNumber(nextToken(&line), &command->y)) {
+            cerr << "Invalid POINT_AT, no coordinates" << endl;
+            return false;
+        }
+        // from_chars happily reads inf and nan
+        if (!isfinite(command->x) || !isfinite(command->y)) {
+            cerr << "Invalid POINT_AT, coordinates not finite" << endl;
+            return false;
+        }
+        break;
+    case Command::Ack:
+        if (!parseNumber(nextToken(&line), &command->tick)) {
+            cerr << "Invalid ACK" << endl;
+            return false;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return true;
+}
+
+void CommandParser::append(const char *data, const size_t size)
+{
+    const size_t tail = (m_head + m_size) % bufferSize;
+    const size_t first = min(size, bufferSize - tail);
+    memcpy(m_buffer + tail, data, first);
+    memcpy(m_buffer, data + first, size - first);
+    m_size += size;
+}
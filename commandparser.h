@@ -0,0 +1,158 @@
+#ifndef COMMANDPARSER_H
+#define COMMANDPARSER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+using namespace std;
+
+struct Command
+{
+    enum Type : uint8_t {
+        Invalid,
+        Name,
+        PointAt,
+        Fire,
+        StrafeLeft,
+        StrafeRight,
+        Forward,
+        Backward,
+        Protocol,
+        Ack,
+        Keyframe,
+        Stats
+    };
+
+    Type type = Invalid;
+
+    // PointAt
+    float x = 0;
+    float y = 0;
+
+    // Ack
+    long tick = 0;
+
+    // Name and Protocol, nul terminated and truncated to fit
+    char text[32] = {};
+
+    string_view textView() const { return string_view(text); }
+    void setText(const string_view &value);
+};
+
+struct CommandName
+{
+    string_view name;
+    Command::Type type;
+};
+
+static constexpr CommandName s_commandNames[] = {
+    { "NAME", Command::Name },
+    { "POINT_AT", Command::PointAt },
+    { "FIRE", Command::Fire },
+    { "STRAFE_LEFT", Command::StrafeLeft },
+    { "STRAFE_RIGHT", Command::StrafeRight },
+    { "FORWARD", Command::Forward },
+    { "BACKWARD", Command::Backward },
+    { "PROTOCOL", Command::Protocol },
+    { "ACK", Command::Ack },
+    { "KEYFRAME", Command::Keyframe },
+    { "STATS", Command::Stats },
+};
+
+constexpr Command::Type commandType(const string_view &name)
+{
+    for (const CommandName &command : s_commandNames) {
+        if (command.name == name) {
+            return command.type;
+        }
+    }
+    return Command::Invalid;
+}
+
+static_assert(commandType("POINT_AT") == Command::PointAt, "command table broken");
+static_assert(commandType("POINT") == Command::Invalid, "command table broken");
+
+// Streaming parser for the text protocol. Reads are copied into a fixed ring
+// buffer and every complete line is parsed in place, so nothing is allocated
+// per command. A line only gets copied if it wraps around the end of the ring.
+class CommandParser
+{
+public:
+    static constexpr size_t bufferSize = 4096;
+
+    // Calls callback(const Command &) for every valid command in the complete
+    // lines, the rest of a line is kept for the next call
+    template<typename Callback>
+    void feed(const char *data, size_t size, const Callback &callback);
+
+    // Lines longer than the buffer are thrown away
+    uint64_t discardedBytes() const { return m_discardedBytes; }
+
+    static bool parseLine(const char *line, size_t length, Command *command);
+
+private:
+    void append(const char *data, const size_t size);
+
+    char m_buffer[bufferSize];
+    size_t m_head = 0; // where the unparsed data starts
+    size_t m_size = 0; // how much unparsed data there is
+    size_t m_scanned = 0; // how much of it is known to have no newline
+
+    char m_line[bufferSize];
+    bool m_skipping = false;
+    uint64_t m_discardedBytes = 0;
+};
+
+template<typename Callback>
+void CommandParser::feed(const char *data, size_t size, const Callback &callback)
+{
+    while (size > 0) {
+        const size_t chunk = min(size, bufferSize - m_size);
+        append(data, chunk);
+        data += chunk;
+        size -= chunk;
+
+        while (m_scanned < m_size) {
+            const size_t newlineIndex = (m_head + m_scanned) % bufferSize;
+            if (m_buffer[newlineIndex] != '\n') {
+                m_scanned++;
+                continue;
+            }
+
+            const size_t length = m_scanned;
+            const char *line = m_buffer + m_head;
+            if (m_head + length > bufferSize) {
+                const size_t first = bufferSize - m_head;
+                memcpy(m_line, m_buffer + m_head, first);
+                memcpy(m_line + first, m_buffer, length - first);
+                line = m_line;
+            }
+
+            Command command;
+            if (m_skipping) {
+                m_discardedBytes += length + 1;
+                m_skipping = false;
+            } else if (parseLine(line, length, &command)) {
+                callback(command);
+            }
+
+            m_head = (m_head + length + 1) % bufferSize;
+            m_size -= length + 1;
+            m_scanned = 0;
+        }
+
+        if (m_size == bufferSize) {
+            // The rest of the line goes too
+            m_skipping = true;
+            m_discardedBytes += m_size;
+            m_head = 0;
+            m_size = 0;
+            m_scanned = 0;
+        }
+    }
+}
+
+#endif // COMMANDPARSER_H
@@ -0,0 +1,50 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include "commandparser.h"
+
+#include <array>
+#include <atomic>
+
+using namespace std;
+
+// Lock-free ring of commands with one producer (the network thread, or the
+// viewer for local players) and one consumer (the tick).
+class CommandQueue
+{
+public:
+    static constexpr size_t capacity = 256;
+
+    // Returns false if the queue is full
+    bool push(const Command &command) {
+        const size_t tail = m_tail.load(memory_order_relaxed);
+        if (tail - m_head.load(memory_order_acquire) == capacity) {
+            return false;
+        }
+        m_commands[tail % capacity] = command;
+        m_tail.store(tail + 1, memory_order_release);
+        return true;
+    }
+
+    // Null if empty, valid until pop()
+    Command *front() {
+        const size_t head = m_head.load(memory_order_relaxed);
+        if (head == m_tail.load(memory_order_acquire)) {
+            return nullptr;
+        }
+        return &m_commands[head % capacity];
+    }
+
+    void pop() {
+        m_head.store(m_head.load(memory_order_relaxed) + 1, memory_order_release);
+    }
+
+private:
+    array<Command, capacity> m_commands;
+
+    // On separate cache lines, they are written by different threads
+    alignas(64) atomic<size_t> m_head { 0 };
+    alignas(64) atomic<size_t> m_tail { 0 };
+};
+
+#endif // COMMANDQUEUE_H
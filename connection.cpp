@@ -0,0 +1,132 @@
+#include "connection.h"
+
+#include <tacopie/utils/error.hpp>
+
+TacopieConnection::TacopieConnection(const shared_ptr<tcp_client> &client) :
+    m_client(client)
+{
+}
+
+void TacopieConnection::setHandlers(DataHandler onData, ClosedHandler onClosed)
+{
+    lock_guard<recursive_mutex> lock(m_handlerMutex);
+    if (m_closed) {
+        return;
+    }
+    m_onData = move(onData);
+    m_onClosed = move(onClosed);
+
+    if (!m_onData) {
+        return;
+    }
+
+    if (!m_unread.empty()) {
+        const string unread = move(m_unread);
+        m_unread.clear();
+        DataHandler handler = m_onData;
+        handler(unread.data(), unread.size());
+    }
+
+    // Stopped reading while nobody wanted it
+    if (!m_reading && m_onData && m_client->is_connected()) {
+        m_reading = true;
+        read();
+    }
+}
+
+bool TacopieConnection::write(vector<char> &&buffer, function<void()> done)
+{
+    const weak_ptr<TacopieConnection> weakThis = shared_from_this();
+    try {
+        m_client->async_write({move(buffer), [weakThis, done](tcp_client::write_result &) {
+            const shared_ptr<TacopieConnection> connection = weakThis.lock();
+            if (!connection || !done) {
+                return;
+            }
+            lock_guard<recursive_mutex> lock(connection->m_handlerMutex);
+            if (!connection->m_closed) {
+                done();
+            }
+        }});
+    } catch (const tacopie::tacopie_error &) {
+        // Disconnected, the read fails too and takes care of it
+        return true;
+    }
+    return false;
+}
+
+bool TacopieConnection::write(const vector<protocol::Slice> &slices, shared_ptr<const void> /*owner*/, function<void()> done)
+{
+    // tacopie only takes a buffer of its own, so here it is copied after all
+    vector<char> buffer;
+    for (const protocol::Slice &slice : slices) {
+        buffer.insert(buffer.end(), slice.data, slice.data + slice.size);
+    }
+    return write(move(buffer), move(done));
+}
+
+bool TacopieConnection::isConnected() const
+{
+    return m_client->is_connected();
+}
+
+void TacopieConnection::close()
+{
+    {
+        lock_guard<recursive_mutex> lock(m_handlerMutex);
+        m_onData = nullptr;
+        m_onClosed = nullptr;
+        m_closed = true;
+    }
+    m_client->disconnect();
+}
+
+void TacopieConnection::read()
+{
+    const weak_ptr<TacopieConnection> weakThis = shared_from_this();
+
+    tcp_client::read_request req;
+    req.size = 4096;
+    req.async_read_callback = [weakThis](tcp_client::read_result &result) {
+        const shared_ptr<TacopieConnection> connection = weakThis.lock();
+        if (connection) {
+            connection->onRead(result);
+        }
+    };
+
+    m_client->async_read(req);
+}
+
+void TacopieConnection::onRead(tcp_client::read_result &result)
+{
+    lock_guard<recursive_mutex> lock(m_handlerMutex);
+
+    if (!result.success) {
+        m_reading = false;
+        const ClosedHandler handler = m_onClosed;
+        m_onData = nullptr;
+        m_onClosed = nullptr;
+        m_closed = true;
+        if (handler) {
+            handler();
+        }
+        return;
+    }
+
+    // Only read more when done with this, so reads are never handled concurrently
+    if (!m_onData) {
+        m_unread.append(result.buffer.begin(), result.buffer.end());
+        m_reading = false;
+        return;
+    }
+
+    // A copy, the handler may replace itself
+    const DataHandler handler = m_onData;
+    handler(result.buffer.data(), result.buffer.size());
+
+    if (m_onData && m_client->is_connected()) {
+        read();
+    } else {
+        m_reading = false;
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "protocol.h"
+
+#include <tacopie/network/tcp_client.hpp>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+using tacopie::tcp_client;
+
+// A bot's socket, whatever runs it. Reads are handed to the data handler on
+// the network thread, one at a time, and writes can come from any thread.
+class Connection
+{
+public:
+    typedef function<void(const char *data, const size_t size)> DataHandler;
+    typedef function<void()> ClosedHandler;
+
+    virtual ~Connection() {}
+
+    // Replaces the handlers, also from inside one of them. What is read while
+    // there is no data handler is kept and handed to the next one, so a
+    // connection can be passed on without losing anything. The closed
+    // handler is called once when the other end goes away, after that the
+    // handlers are dropped.
+    virtual void setHandlers(DataHandler onData, ClosedHandler onClosed) = 0;
+
+    // Takes the buffer. True if it was all written right away, otherwise done
+    // is called from the network thread when it is, but never after close().
+    virtual bool write(vector<char> &&buffer, function<void()> done) = 0;
+
+    // The same without copying, for the updates that are put together from
+    // a shared Snapshot. The slices, and what they point into, have to stay
+    // valid as long as owner does, which is held until done has been called.
+    virtual bool write(const vector<protocol::Slice> &slices, shared_ptr<const void> owner, function<void()> done) = 0;
+
+    virtual bool isConnected() const = 0;
+
+    // Drops the handlers, they are not called anymore once this returns
+    virtual void close() = 0;
+};
+
+// On top of tacopie, for the viewer and wherever there is no Reactor
+class TacopieConnection : public Connection, public enable_shared_from_this<TacopieConnection>
+{
+public:
+    TacopieConnection(const shared_ptr<tcp_client> &client);
+
+    void setHandlers(DataHandler onData, ClosedHandler onClosed) override;
+    bool write(vector<char> &&buffer, function<void()> done) override;
+    bool write(const vector<protocol::Slice> &slices, shared_ptr<const void> owner, function<void()> done) override;
+    bool isConnected() const override;
+    void close() override;
+
+private:
+    void read();
+    void onRead(tcp_client::read_result &result);
+
+    shared_ptr<tcp_client> m_client;
+
+    // Held while a handler runs, so close() waits for it
+    recursive_mutex m_handlerMutex;
+    DataHandler m_onData;
+    ClosedHandler m_onClosed;
+    string m_unread;
+    bool m_reading = false;
+    bool m_closed = false;
+};
+
+#endif // CONNECTION_H
@@ -1,12 +1,16 @@
 #!/usr/bin/python           # This is server.py file
 
 import socket               # Import socket module
+import sys
 from random import random
 from time import sleep
 
 s = socket.socket()         # Create a socket object
 host = "127.0.0.1" # Get local machine name
 port = 1337                # Reserve a port for your service.
+if len(sys.argv) > 2:       # Host and port from tg18ai-tournament
+    host = sys.argv[1]
+    port = int(sys.argv[2])
 
 s.connect((host, port))
 s.send(b"NAME rand2m\n")
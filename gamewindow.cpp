@@ -1,29 +1,21 @@
 #include "gamewindow.h"
 
 #include "player.h"
+#include "playernode.h"
 
 #include "Perfect_Dark_Zero.ttf.h"
 
 #include <tacopie/utils/error.hpp>
-#include <unordered_map>
 #include <chrono>
+#include <cmath>
 
 
-GameWindow::GameWindow() :
-    m_gameRunning(true)
+GameWindow::GameWindow(const int playerCount, const int maxPlayers, const uint32_t seed) :
+    m_gameRunning(true),
+    m_playerCount(playerCount),
+    m_maxPlayers(maxPlayers),
+    m_seed(seed ? seed : Random::randomSeed())
 {
-    m_nextUpdate = m_clock.now();
-
-    try {
-        m_tcpServer.start("localhost", 1337, [=] (const std::shared_ptr<tcp_client>& client) -> bool {
-            std::cout << "New client" << std::endl;
-            return this->onNewClient(client);
-        });
-    } catch (const tacopie::tacopie_error &error) {
-        cerr << "error when listening: " << error.what() << endl;
-        Backend::get()->quit();
-        return;
-    }
 }
 
 GameWindow::~GameWindow()
@@ -45,27 +37,32 @@ Node *GameWindow::build()
     m_blurNode = BlurNode::create(20);
     *root << m_blurNode;
 
-    const int width = size().x;
-    const int height = size().y;
+    cout << "Seed " << m_seed << endl;
+    unique_ptr<World> world = make_unique<World>(Vec2(size().x, size().y), m_seed);
+    world->setMaxPlayers(m_maxPlayers);
+    world->build(m_playerCount);
 
-    rand();
-    const int rectCount = (rand() % 10) + 5;
-    for (int i=0; i<rectCount; i++) {
-        const int rectWidth = (rand() % 200) + 20;
-        const int rectHeight = (rand() % 200) + 20;
-        rect2d geometry = rect2d::fromXywh(rand() % (width - rectWidth), rand() % (height - rectHeight), rectWidth, rectHeight);
-        RectangleNode *rect = RectangleNode::create(geometry, vec4(1, 1, 1, 0.3));
+    // The map never changes, so it can be read before the simulation starts
+    for (const Rect &geometry : world->rectangles()) {
+        RectangleNode *rect = RectangleNode::create(rect2d(toVec2(geometry.tl), toVec2(geometry.br)), vec4(1, 1, 1, 0.3));
         *m_blurNode << rect;
-        m_rectangles.push_back(geometry);
     }
 
-    m_players.push_back(make_shared<Player>(vec4(1, .6, .6, 1), this));
-    m_players.push_back(make_shared<Player>(vec4(.6, 1, .6, 1), this));
-    m_players.push_back(make_shared<Player>(vec4(.6, .6, 1, 1), this));
-
-    for (shared_ptr<Player> player : m_players) {
-        *m_blurNode << player.get();
-    }
+    m_visibilityLayer = new PolygonBatchNode;
+    m_visibilityLayer->setGeometry(rect2d::fromXywh(0, 0, size().x, size().y));
+    *m_blurNode << m_visibilityLayer;
+    m_bodyLayer = new PolygonBatchNode;
+    m_bodyLayer->setGeometry(rect2d::fromXywh(0, 0, size().x, size().y));
+    *m_blurNode << m_bodyLayer;
+    m_playersNode = Node::create();
+    *m_blurNode << m_playersNode;
+    m_bulletLayer = new BulletLayerNode;
+    m_bulletLayer->setGeometry(rect2d::fromXywh(0, 0, size().x, size().y));
+    *m_blurNode << m_bulletLayer;
+
+    m_simulation = make_unique<Simulation>(move(world));
+    m_scene = m_simulation->state();
+    addPlayerNodes();
 
     m_overlay = RectangleNode::create(rect2d::fromPosSize(vec2(0, 0), size()), vec4(0.f, 0.f, 0.f, 0.5));
     *root << m_overlay;
@@ -75,18 +72,44 @@ Node *GameWindow::build()
 
     m_gameRunning = false;
 
+    m_simulation->start();
+    listen();
+
     return root;
 }
 
+// Only once the Simulation is there, the clients are accepted on tacopie's
+// own threads
+void GameWindow::listen()
+{
+    try {
+        m_tcpServer.start("localhost", 1337, [=] (const std::shared_ptr<tcp_client>& client) -> bool {
+            std::cout << "New client" << std::endl;
+            const shared_ptr<Connection> connection = make_shared<TacopieConnection>(client);
+            m_simulation->post([connection](World *world) {
+                if (!world->onNewClient(connection)) {
+                    connection->close();
+                }
+            });
+            return true;
+        });
+    } catch (const tacopie::tacopie_error &error) {
+        cerr << "error when listening: " << error.what() << endl;
+        Backend::get()->quit();
+    }
+}
+
 void GameWindow::onEvent(Event *event)
 {
     if (event->type() == Event::KeyDown ) {
         KeyEvent *keyEvent = KeyEvent::from(event);
-        if (keyEvent->keyCode() == KeyEvent::Key_Q) {
+        if (keyEvent->keyCode() == KeyEvent::Key_Q || keyEvent->keyCode() == KeyEvent::Key_Escape) {
             Backend::get()->quit();
             return;
         } else if (keyEvent->keyCode() == KeyEvent::Key_Space) {
-            setGameRunning(!m_gameRunning);
+            if (!m_gameOver) {
+                setGameRunning(!m_gameRunning);
+            }
             return;
         }
     }
@@ -95,132 +118,141 @@ void GameWindow::onEvent(Event *event)
         return;
     }
 
-    bool needRender = false;
+    Command command;
 
-    for (shared_ptr<Player> player : m_players) {
-        needRender = player->handleEvent(event) || needRender;
-        player->sendUpdate(json::JSON());
+    switch(event->type()) {
+    case Event::PointerMove: {
+        vec2 cursorPos = PointerEvent::from(event)->position();
+        command.type = Command::PointAt;
+        command.x = cursorPos.x;
+        command.y = cursorPos.y;
+        break;
     }
-
-    if (needRender) {
-        requestRender();
+    case Event::PointerDown: {
+        command.type = Command::Fire;
+        break;
     }
-}
-
-shared_ptr<Player> GameWindow::getPlayerAt(vec2 position)
-{
-    for (shared_ptr<Player> player : m_players) {
-        if (!player->isAlive()) {
-            continue;
-        }
-
-        if (player->geometry().contains(position)) {
-            return player;
+    case Event::KeyDown: {
+        KeyEvent *keyEvent = KeyEvent::from(event);
+        switch(keyEvent->keyCode()) {
+        case KeyEvent::Key_Up:
+            command.type = Command::Forward;
+            break;
+        case KeyEvent::Key_Down:
+            command.type = Command::Backward;
+            break;
+        case KeyEvent::Key_Left:
+            command.type = Command::StrafeLeft;
+            break;
+        case KeyEvent::Key_Right:
+            command.type = Command::StrafeRight;
+            break;
+        case KeyEvent::Key_R:
+            m_simulation->post([](World *world) {
+                for (const shared_ptr<Player> &player : world->allPlayers()) {
+                    if (!player->isActive()) {
+                        player->respawn();
+                    }
+                }
+            });
+            return;
+        default:
+            return;
         }
+        break;
     }
-
-    return nullptr;
-}
-
-bool GameWindow::onNewClient(std::shared_ptr<tcp_client> client)
-{
-    if (!m_gameRunning) {
-        return false;
+    default:
+        return;
     }
 
-    for (shared_ptr<Player> player : m_players) {
-        if (player->isActive()) {
-            continue;
+    // Everyone not remote controlled follows the local input
+    m_simulation->post([command](World *world) {
+        for (const shared_ptr<Player> &player : world->allPlayers()) {
+            if (player->isActive() || !player->isAlive()) {
+                continue;
+            }
+            player->queueCommand(command);
         }
-        player->setTcpConnection(client);
-        return true;
-    }
-
-    cerr << "Unable to find free player" << endl;
-    return false;
+    });
 }
 
-vector<shared_ptr<Player> > GameWindow::players(const int exceptPlayer) const
+// Every frame is drawn somewhere between the state before and the newest one,
+// so movement is smooth at whatever rate the display runs at.
+void GameWindow::onBeforeRender()
 {
-    vector<shared_ptr<Player>> ret;
-    for (shared_ptr<Player> player : m_players) {
-        if (player->id == exceptPlayer) {
-            continue;
-        }
-        if (!player->isAlive()) {
-            continue;
-        }
-        ret.push_back(player);
-    }
+    const chrono::duration<float> sinceTick = chrono::steady_clock::now() - m_scene->time;
+    const float progress = std::min(sinceTick / chrono::duration<float>(World::tickInterval), 1.f);
 
-    return ret;
-}
+    for (PlayerNode *node : m_playerNodes) {
+        node->interpolate(progress);
+    }
+    m_bulletLayer->interpolate(progress);
 
-void GameWindow::onBeforeRender()
-{
+    if (progress < 1) {
+        requestRender();
+    }
 }
 
 void GameWindow::onTick()
 {
-    if (!m_gameRunning) {
+    const shared_ptr<const SceneState> scene = m_simulation->state();
+    if (scene == m_scene) {
         return;
     }
+    m_scene = scene;
 
-    if (m_clock.now() < m_nextUpdate) {
-        return;
+    {
+        ScopedTimer timer(&m_simulation->profiler(), Profiler::Scene);
+        syncScene();
     }
-    m_nextUpdate = m_clock.now() + 20ms;
-
-    vector<shared_ptr<Player>> playersAlive;
-    // Collect current states
-    unordered_map<int, json::JSON> states;
-    for (shared_ptr<Player> player : m_players) {
-        if (!player->isAlive()) {
-            continue;
-        }
 
-        playersAlive.push_back(player);
-
-        player->update();
-        states[player->id] = player->serializeState();
-    }
-
-    if (playersAlive.empty()) {
-        std::cout << "no players alive" << std::endl;
-        handleDraw();
-        return;
+    if (m_scene->gameOver && !m_gameOver) {
+        showResult();
     }
+}
 
-    if (playersAlive.size() == 1) {
-        std::cout << "player won" << std::endl;
-        handleWinner(playersAlive[0]);
-        return;
+// Hues spread by the golden ratio stay apart however many players there are
+static vec4 playerColor(const int index)
+{
+    const float hue = fmod(index * 0.618034f, 1.f) * 6;
+    const float x = 1 - fabs(fmod(hue, 2.f) - 1);
+    float r, g, b;
+    switch(int(hue)) {
+    case 0: r = 1; g = x; b = 0; break;
+    case 1: r = x; g = 1; b = 0; break;
+    case 2: r = 0; g = 1; b = x; break;
+    case 3: r = 0; g = x; b = 1; break;
+    case 4: r = x; g = 0; b = 1; break;
+    default: r = 1; g = 0; b = x; break;
     }
 
-    for (shared_ptr<Player> player : m_players) {
-        json::JSON others = json::Array();
+    // Pastel, like the original three
+    return vec4(0.6f + r * 0.4f, 0.6f + g * 0.4f, 0.6f + b * 0.4f, 1);
+}
 
-        for (shared_ptr<Player> other : m_players) {
-            if (other->id == player->id) {
-                continue;
-            }
-            others.append(other->serializeState());
-        }
-        json::JSON worldState;
-        worldState["others"] = move(others);
-        player->sendUpdate(worldState);
+// For players that joined since last time
+void GameWindow::addPlayerNodes()
+{
+    const vector<SceneState::PlayerState> &players = m_scene->players;
+    while (m_playerNodes.size() < players.size()) {
+        PlayerNode *node = new PlayerNode(players[m_playerNodes.size()], playerColor(m_playerNodes.size()), this);
+        *m_playersNode << node;
+        m_bulletLayer->setOwnerColor(m_playerNodes.size(), node->color());
+        m_playerNodes.push_back(node);
     }
 }
 
-bool GameWindow::isInside(const vec2 &position) const
+void GameWindow::syncScene()
 {
-    for (const rect2d &rectangle : m_rectangles) {
-        if (rectangle.contains(position)) {
-            return true;
-        }
+    addPlayerNodes();
+
+    for (size_t i=0; i<m_playerNodes.size(); i++) {
+        m_playerNodes[i]->sync(m_scene->players[i]);
     }
 
-    return false;
+    m_bulletLayer->sync(m_scene->bullets);
+
+    requestRender();
 }
 
 void GameWindow::setOverlayText(const string &text)
@@ -235,12 +267,25 @@ void GameWindow::setOverlayText(const string &text)
     m_overlayText->setGeometry(rect2d::fromPosSize(pos, t->size()));
 }
 
+void GameWindow::showResult()
+{
+    m_gameOver = true;
+    m_gameRunning = false;
+    renderer()->sceneRoot()->append(m_overlay);
+    m_blurNode->setRadius(20);
+    setOverlayText(m_scene->result);
+    requestRender();
+}
+
 void GameWindow::setGameRunning(const bool running)
 {
     if (running == m_gameRunning) {
         return;
     }
     m_gameRunning = running;
+    m_simulation->post([running](World *world) {
+        world->setRunning(running);
+    });
 
     if (m_gameRunning) {
         renderer()->sceneRoot()->remove(m_overlay);
@@ -252,23 +297,3 @@ void GameWindow::setGameRunning(const bool running)
     }
     requestRender();
 }
-
-void GameWindow::handleGameOver()
-{
-    m_gameRunning = false;
-    for (shared_ptr<Player> player : m_players) {
-        player->closeConnection();
-    }
-}
-
-void GameWindow::handleDraw()
-{
-    handleGameOver();
-
-}
-
-void GameWindow::handleWinner(shared_ptr<Player> winner)
-{
-    std::cout << winner->name() << " won" << std::endl;
-    handleGameOver();
-}
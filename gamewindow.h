@@ -1,15 +1,20 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
-#include "polygonnode.h"
+#include "bulletlayernode.h"
+#include "polygonbatchnode.h"
+#include "simulation.h"
+#include "world.h"
 
 #include "rengine.h"
 
 #include <SimpleJSON/json.hpp>
 #include <tacopie/network/tcp_server.hpp>
 #include <chrono>
+#include <unordered_map>
 
 class Player;
+class PlayerNode;
 
 
 using tacopie::tcp_client;
@@ -19,48 +24,55 @@ using namespace rengine;
 using namespace std;
 using namespace std::chrono_literals;
 
+// Viewer for a World. The Simulation ticks it on its own thread, this mirrors
+// the states it publishes into the scene graph and posts the input to it.
 class GameWindow : public rengine::StandardSurface
 {
 public:
-    GameWindow();
+    // A seed of 0 means a random map
+    GameWindow(const int playerCount = World::defaultPlayerCount, const int maxPlayers = 0, const uint32_t seed = 0);
     ~GameWindow();
 
     rengine::Node *build() override;
     void onEvent(Event *event) override;
-    const vector<rect2d> &rectangles() const { return m_rectangles; }
-
-    shared_ptr<Player> getPlayerAt(vec2 position);
-
-    bool onNewClient(std::shared_ptr<tacopie::tcp_client> client);
 
     GlyphContext *font() const { return m_font; }
 
-    vector<shared_ptr<Player>> players(const int exceptPlayer) const;
+    // All the players' visibility polygons and bodies, each layer in one go
+    PolygonBatchNode *visibilityLayer() const { return m_visibilityLayer; }
+    PolygonBatchNode *bodyLayer() const { return m_bodyLayer; }
 
     void onBeforeRender() override;
     void onTick() override;
 
-    bool isInside(const vec2 &position) const;
-
 private:
     void setOverlayText(const string &text);
     void setGameRunning(const bool running);
+    void listen();
 
-    void handleGameOver();
-    void handleDraw();
-    void handleWinner(shared_ptr<Player> winner);
+    void syncScene();
+    void addPlayerNodes();
+    void showResult();
 
-    vector<rect2d> m_rectangles;
-    vector<shared_ptr<Player>> m_players;
+    unique_ptr<Simulation> m_simulation;
+    // What the scene shows
+    shared_ptr<const SceneState> m_scene;
+    vector<PlayerNode*> m_playerNodes;
     tcp_server m_tcpServer;
     GlyphContext *m_font = nullptr;
-    chrono::steady_clock m_clock;
-    chrono::steady_clock::time_point m_nextUpdate;
     bool m_gameRunning;
+    bool m_gameOver = false;
+    int m_playerCount;
+    int m_maxPlayers;
+    uint32_t m_seed;
 
     RectangleNode *m_overlay;
     TextureNode *m_overlayText;
     BlurNode *m_blurNode;
+    PolygonBatchNode *m_visibilityLayer;
+    PolygonBatchNode *m_bodyLayer;
+    Node *m_playersNode;
+    BulletLayerNode *m_bulletLayer;
 };
 
 #endif // WINDOW_H
@@ -0,0 +1,98 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <algorithm>
+#include <cmath>
+
+// Minimal math types for the simulation, so it doesn't have to pull in
+// rengine (and with it SDL and GL) when running headless.
+
+struct Vec2
+{
+    Vec2() = default;
+    Vec2(float x_, float y_) : x(x_), y(y_) {}
+
+    Vec2 operator+(const Vec2 &other) const { return Vec2(x + other.x, y + other.y); }
+    Vec2 operator-(const Vec2 &other) const { return Vec2(x - other.x, y - other.y); }
+    Vec2 operator*(float factor) const { return Vec2(x * factor, y * factor); }
+    Vec2 &operator+=(const Vec2 &other) { x += other.x; y += other.y; return *this; }
+    bool operator==(const Vec2 &other) const { return x == other.x && y == other.y; }
+    bool operator!=(const Vec2 &other) const { return !(*this == other); }
+
+    float length() const { return std::hypot(x, y); }
+
+    float x = 0;
+    float y = 0;
+};
+
+struct Rect
+{
+    Rect() = default;
+    Rect(const Vec2 &topLeft, const Vec2 &bottomRight) : tl(topLeft), br(bottomRight) {}
+
+    static Rect fromXywh(float x, float y, float w, float h) { return Rect(Vec2(x, y), Vec2(x + w, y + h)); }
+    static Rect fromCenter(const Vec2 &center, const Vec2 &size) { return Rect(center - size * 0.5f, center + size * 0.5f); }
+
+    float width() const { return br.x - tl.x; }
+    float height() const { return br.y - tl.y; }
+    Vec2 center() const { return Vec2((tl.x + br.x) / 2, (tl.y + br.y) / 2); }
+
+    bool contains(const Vec2 &p) const { return p.x >= tl.x && p.x <= br.x && p.y >= tl.y && p.y <= br.y; }
+
+    // Slab test, gives the part of the segment from -> to (as 0..1) that is inside
+    bool intersects(const Vec2 &from, const Vec2 &to, float *enter, float *exit) const {
+        float tmin = 0;
+        float tmax = 1;
+
+        const float d[2] = { to.x - from.x, to.y - from.y };
+        const float o[2] = { from.x, from.y };
+        const float lo[2] = { tl.x, tl.y };
+        const float hi[2] = { br.x, br.y };
+
+        for (int axis=0; axis<2; axis++) {
+            if (d[axis] == 0) {
+                if (o[axis] < lo[axis] || o[axis] > hi[axis]) {
+                    return false;
+                }
+                continue;
+            }
+
+            float t1 = (lo[axis] - o[axis]) / d[axis];
+            float t2 = (hi[axis] - o[axis]) / d[axis];
+            if (t1 > t2) {
+                std::swap(t1, t2);
+            }
+            tmin = std::max(tmin, t1);
+            tmax = std::min(tmax, t2);
+            if (tmin > tmax) {
+                return false;
+            }
+        }
+
+        *enter = tmin;
+        *exit = tmax;
+        return true;
+    }
+
+    Vec2 tl;
+    Vec2 br;
+};
+
+struct Segment
+{
+    Segment() = default;
+    Segment(const Vec2 &a_, const Vec2 &b_) : a(a_), b(b_) {}
+
+    Vec2 a;
+    Vec2 b;
+};
+
+// Where two segments cross each other, not counting shared endpoints
+struct SegmentCrossing
+{
+    int first;
+    int second;
+    Vec2 point;
+};
+
+#endif // GEOMETRY_H
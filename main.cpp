@@ -1,6 +1,6 @@
 #include "gamewindow.h"
 
-#include "player.h"
+#include "playernode.h"
 
 #define  STB_TRUETYPE_IMPLEMENTATION
 #include <stb_truetype.h>
@@ -18,8 +18,6 @@ extern "C" {
 
 RENGINE_DEFINE_GLOBALS
 
-RENGINE_ALLOCATION_POOL_DEFINITION(Bullet, BulletNode);
-
 void sigintHandler(int)
 {
     cout << "quitting gracefully" << endl;
@@ -29,8 +27,23 @@ void sigintHandler(int)
 
 int main(int argc, char **argv)
 {
-    (void)argc;
-    (void)argv;
+    int playerCount = World::defaultPlayerCount;
+    int maxPlayers = 0;
+    uint32_t seed = 0;
+    for (int i=1; i<argc; i++) {
+        const string arg = argv[i];
+        if (arg == "--players" && i + 1 < argc) {
+            playerCount = atoi(argv[++i]);
+        } else if (arg == "--max-players" && i + 1 < argc) {
+            maxPlayers = atoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else {
+            cerr << "Usage: " << argv[0] << " [--players <n>] [--max-players <n>] [--seed <n>]" << endl;
+            return 1;
+        }
+    }
+
 #ifdef _WIN32
     //! Windows netword DLL init
     WORD version = MAKEWORD(2, 2);
@@ -42,7 +55,6 @@ int main(int argc, char **argv)
     }
 #endif//_WIN32
 
-    RENGINE_ALLOCATION_POOL(Bullet, BulletNode, 1024);
     RENGINE_ALLOCATION_POOL(rengine::TransformNode, rengine_TransformNode, 256);
     RENGINE_ALLOCATION_POOL(rengine::SimplifiedTransformNode, rengine_SimplifiedTransformNode, 256);
     RENGINE_ALLOCATION_POOL(rengine::RectangleNode, rengine_RectangleNode, 256);
@@ -55,7 +67,7 @@ int main(int argc, char **argv)
 
     RENGINE_BACKEND backend;
 
-    GameWindow window;
+    GameWindow window(playerCount, maxPlayers, seed);
     window.show();
 
     signal(SIGINT, &sigintHandler);
@@ -0,0 +1,294 @@
+#include "matchhost.h"
+
+#include <tacopie/utils/error.hpp>
+
+#include <charconv>
+#include <cstdio>
+#include <iostream>
+#include <string_view>
+#include <thread>
+
+MatchHost::MatchHost(const Options &options) :
+    m_options(options),
+    m_pool(options.threadCount)
+{
+    for (int i=0; i<m_options.matchCount; i++) {
+        const uint32_t seed = m_options.seed ? m_options.seed + i : Random::randomSeed();
+        unique_ptr<World> world = make_unique<World>(m_options.size, seed);
+        if (m_options.matchCount > 1) {
+            cout << "Match " << i << " seed " << seed << endl;
+        } else {
+            cout << "Seed " << seed << endl;
+        }
+        if (m_options.commandBudget > 0) {
+            world->setCommandBudget(m_options.commandBudget);
+        }
+        world->setMaxPlayers(m_options.maxPlayers);
+        world->build(m_options.playerCount);
+        world->setRunning(true);
+        if (!m_options.recordPath.empty()) {
+            world->startRecording(m_options.matchCount > 1 ? m_options.recordPath + "." + to_string(i) : m_options.recordPath);
+        }
+        m_worlds.push_back(move(world));
+    }
+    m_matches.resize(m_worlds.size());
+}
+
+MatchHost::~MatchHost()
+{
+#ifdef __linux__
+    m_reactor.reset();
+#endif
+    if (m_lobby) {
+        m_lobby->stop(true, true);
+    }
+    for (Match &match : m_matches) {
+        if (match.server) {
+            match.server->stop(true, true);
+        }
+    }
+}
+
+bool MatchHost::start()
+{
+#ifdef __linux__
+    if (!m_options.tacopie) {
+        return startReactor();
+    }
+#endif
+
+    try {
+        if (m_options.joinRouting) {
+            m_lobby = make_unique<tcp_server>();
+            m_lobby->start(m_options.host, m_options.port, [this] (const shared_ptr<tcp_client> &client) -> bool {
+                onLobbyClient(make_shared<TacopieConnection>(client));
+                return true;
+            });
+            return true;
+        }
+
+        for (size_t i=0; i<m_matches.size(); i++) {
+            World *world = m_worlds[i].get();
+            m_matches[i].server = make_unique<tcp_server>();
+            m_matches[i].server->start(m_options.host, m_options.port + i, [world] (const shared_ptr<tcp_client> &client) -> bool {
+                cout << "New client" << endl;
+                return world->onNewClient(make_shared<TacopieConnection>(client));
+            });
+        }
+    } catch (const tacopie::tacopie_error &error) {
+        cerr << "error when listening: " << error.what() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+#ifdef __linux__
+bool MatchHost::startReactor()
+{
+    m_reactor = make_unique<Reactor>(m_options.networkThreadCount);
+
+    if (m_options.joinRouting) {
+        if (!m_reactor->listen(m_options.host, m_options.port, [this] (const shared_ptr<Connection> &connection) {
+            onLobbyClient(connection);
+            return true;
+        })) {
+            cerr << "error when listening: " << m_reactor->errorString() << endl;
+            return false;
+        }
+        return true;
+    }
+
+    for (size_t i=0; i<m_worlds.size(); i++) {
+        World *world = m_worlds[i].get();
+        if (!m_reactor->listen(m_options.host, m_options.port + i, [world] (const shared_ptr<Connection> &connection) {
+            cout << "New client" << endl;
+            return world->onNewClient(connection);
+        })) {
+            cerr << "error when listening: " << m_reactor->errorString() << endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+#endif
+
+void MatchHost::onLobbyClient(const shared_ptr<Connection> &connection)
+{
+    const shared_ptr<string> buffer = make_shared<string>();
+
+    // Keeps the connection alive until it has joined a match or given up
+    connection->setHandlers([this, connection, buffer](const char *data, const size_t size) {
+        buffer->append(data, size);
+        const size_t newline = buffer->find('\n');
+        if (newline == string::npos) {
+            if (buffer->size() > 1024) {
+                cerr << "No JOIN from client" << endl;
+                connection->close();
+            }
+            return;
+        }
+
+        string_view line(buffer->data(), newline);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+
+        int index = -1;
+        if (line.substr(0, 5) == "JOIN ") {
+            from_chars(line.data() + 5, line.data() + line.size(), index);
+        }
+
+        if (index < 0 || index >= int(m_worlds.size())) {
+            cerr << "Invalid JOIN, expected JOIN <0-" << m_worlds.size() - 1 << ">" << endl;
+            connection->close();
+            return;
+        }
+
+        // Anything more waits in the connection for the player
+        const shared_ptr<Connection> joining = connection;
+        const string rest = buffer->substr(newline + 1);
+        joining->setHandlers(nullptr, nullptr);
+
+        if (m_worlds[index]->onNewClient(joining, rest)) {
+            cout << "New client in match " << index << endl;
+        } else {
+            joining->close();
+        }
+    }, nullptr);
+}
+
+bool MatchHost::isReady(const size_t index)
+{
+    Match &match = m_matches[index];
+    const World &world = *m_worlds[index];
+    if (!match.started) {
+        match.started = !m_options.waitForPlayers || world.connectedCount() >= int(world.allPlayers().size());
+    }
+    return match.started && world.isRunning();
+}
+
+void MatchHost::run(const atomic<bool> &quit)
+{
+    if (m_options.waitForPlayers) {
+        if (m_worlds.size() == 1) {
+            cout << "Waiting for " << m_worlds[0]->allPlayers().size() << " players on port " << m_options.port << endl;
+        } else {
+            cout << "Waiting for " << m_options.playerCount << " players in each of " << m_worlds.size() << " matches" << endl;
+        }
+    }
+
+    chrono::steady_clock::time_point nextStats = chrono::steady_clock::now() + m_options.statsInterval;
+
+    while (!quit) {
+        const chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (!m_options.statsPath.empty() && now >= nextStats) {
+            writeStats();
+            nextStats += m_options.statsInterval;
+        }
+
+        uint64_t ticksFinished;
+        {
+            lock_guard<mutex> lock(m_tickMutex);
+            ticksFinished = m_ticksFinished;
+        }
+
+        // Checked again at least this often while waiting for players
+        chrono::steady_clock::time_point wakeUp = now + 10ms;
+        bool anyRunning = false;
+        for (size_t i=0; i<m_worlds.size(); i++) {
+            Match &match = m_matches[i];
+            {
+                lock_guard<mutex> lock(m_tickMutex);
+                if (match.ticking) {
+                    anyRunning = true;
+                    continue;
+                }
+            }
+
+            World *world = m_worlds[i].get();
+            anyRunning = anyRunning || world->isRunning();
+            if (!isReady(i)) {
+                continue;
+            }
+            if (m_startTime == chrono::steady_clock::time_point()) {
+                m_startTime = now;
+            }
+            if (match.nextTick == chrono::steady_clock::time_point()) {
+                match.nextTick = now;
+            }
+            if (!m_options.fast) {
+                if (match.nextTick > now) {
+                    wakeUp = min(wakeUp, match.nextTick);
+                    continue;
+                }
+                // Behind schedule it ticks back to back until it has caught up
+                match.nextTick += World::tickInterval;
+            }
+
+            {
+                lock_guard<mutex> lock(m_tickMutex);
+                match.ticking = true;
+            }
+            m_pool.submit([this, &match, world]() {
+                world->tick();
+                {
+                    lock_guard<mutex> lock(m_tickMutex);
+                    match.ticking = false;
+                    match.tickCount = world->tickCount();
+                    m_ticksFinished++;
+                }
+                m_ticked.notify_one();
+            });
+        }
+
+        if (!anyRunning) {
+            break;
+        }
+
+        // Until a match is due or one is done with its tick
+        unique_lock<mutex> lock(m_tickMutex);
+        m_ticked.wait_until(lock, wakeUp, [&]() { return m_ticksFinished != ticksFinished; });
+    }
+
+    m_pool.wait();
+
+    if (!m_options.statsPath.empty()) {
+        writeStats();
+    }
+}
+
+void MatchHost::writeStats()
+{
+    // Written next to it and renamed, so whoever watches it never sees half
+    const string temporaryPath = m_options.statsPath + ".tmp";
+    FILE *file = fopen(temporaryPath.c_str(), "w");
+    if (!file) {
+        cerr << "Failed to open " << temporaryPath << " for writing" << endl;
+        return;
+    }
+    for (size_t i=0; i<m_worlds.size(); i++) {
+        long tickCount;
+        {
+            lock_guard<mutex> lock(m_tickMutex);
+            tickCount = m_matches[i].tickCount;
+        }
+        const string line = "{\"match\":" + to_string(i) + ",\"ticks\":" + to_string(tickCount) + "," +
+                m_worlds[i]->profiler().toJson().substr(1) + "\n";
+        fwrite(line.data(), 1, line.size(), file);
+    }
+    fclose(file);
+
+    if (rename(temporaryPath.c_str(), m_options.statsPath.c_str()) != 0) {
+        cerr << "Failed to write " << m_options.statsPath << endl;
+    }
+}
+
+double MatchHost::elapsedSeconds() const
+{
+    if (m_startTime == chrono::steady_clock::time_point()) {
+        return 0;
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - m_startTime).count();
+}
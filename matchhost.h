@@ -0,0 +1,110 @@
+#ifndef MATCHHOST_H
+#define MATCHHOST_H
+
+#include "reactor.h"
+#include "threadpool.h"
+#include "world.h"
+
+#include <tacopie/network/tcp_server.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using tacopie::tcp_server;
+
+using namespace std;
+
+// Runs several independent matches in one process, ticking them on a thread
+// pool. Every match keeps its own tick schedule, so one with slow ticks
+// doesn't hold back the rest. Bots either connect to the port of their match (the first match is on
+// the base port, the next on the one after it and so on), or with join
+// routing all connect to the base port and start with "JOIN <match>".
+class MatchHost
+{
+public:
+    struct Options {
+        string host = "localhost";
+        int port = 1337;
+        int matchCount = 1;
+        bool joinRouting = false;
+
+        Vec2 size = Vec2(1280, 720);
+        int playerCount = World::defaultPlayerCount;
+        int maxPlayers = 0;
+        int commandBudget = 0;
+
+        // Seeds are seed, seed + 1, ... for the matches, 0 for random ones
+        uint32_t seed = 0;
+
+        bool fast = false;
+        bool waitForPlayers = true;
+        int threadCount = 0;
+
+        // The epoll Reactor on Linux, unless told to use tacopie like
+        // everywhere else
+        bool tacopie = false;
+        int networkThreadCount = 1;
+
+        // Replay file, with .<match> appended when there are several
+        string recordPath;
+
+        // Rewritten every statsInterval with one line of tick stats per match
+        string statsPath;
+        chrono::seconds statsInterval = chrono::seconds(10);
+    };
+
+    MatchHost(const Options &options);
+    ~MatchHost();
+
+    // Starts listening, false if that fails
+    bool start();
+
+    // Ticks until every match is over or quit is set
+    void run(const atomic<bool> &quit);
+
+    // Since the first tick, so not counting the wait for players
+    double elapsedSeconds() const;
+
+    const vector<unique_ptr<World>> &worlds() const { return m_worlds; }
+    int threadCount() const { return m_pool.threadCount(); }
+
+private:
+    struct Match {
+        unique_ptr<tcp_server> server;
+        bool started = false;
+        chrono::steady_clock::time_point nextTick;
+
+        // Set while the world is ticking on the pool, and the world is only
+        // touched there then. Both guarded by m_tickMutex.
+        bool ticking = false;
+        long tickCount = 0;
+    };
+
+    bool isReady(const size_t index);
+    void onLobbyClient(const shared_ptr<Connection> &connection);
+    void writeStats();
+#ifdef __linux__
+    bool startReactor();
+#endif
+
+    Options m_options;
+    vector<unique_ptr<World>> m_worlds;
+    vector<Match> m_matches;
+    unique_ptr<tcp_server> m_lobby;
+#ifdef __linux__
+    unique_ptr<Reactor> m_reactor;
+#endif
+    ThreadPool m_pool;
+    chrono::steady_clock::time_point m_startTime;
+
+    mutex m_tickMutex;
+    condition_variable m_ticked;
+    uint64_t m_ticksFinished = 0;
+};
+
+#endif // MATCHHOST_H
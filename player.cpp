@@ -1,9 +1,14 @@
 #include "player.h"
 
-#include "gamewindow.h"
+#include "world.h"
+#include "snapshot.h"
+#include "visibility.h"
 
 #include <SimpleJSON/json.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <iostream>
 #include <mutex>
 
 #ifndef M_PI_2
@@ -11,285 +16,97 @@
 #define M_PI_2		1.57079632679489661923
 #endif
 
-int Bullet::s_idCounter;
-
-#define TURRET_WIDTH 14
-#define TURRET_HEIGHT 14
-#define PLAYER_WIDTH 20
-#define PLAYER_HEIGHT 20
-
-Bullet::Bullet() :
-    id(s_idCounter++),
-    m_xAnimation(make_shared<RectangleXAnimation>(this)),
-    m_yAnimation(make_shared<RectangleYAnimation>(this)),
-    m_startedInside(false)
-{
-}
-
-Bullet::~Bullet()
-{
-    m_owner->removeBullet(this);
-}
-
-void Bullet::setOwner(Player *owner)
-{
-    m_owner = owner;
-    m_world = owner->world();
-}
-
-void Bullet::setTarget(vec2 target)
-{
-    m_target = target;
-
-    m_xAnimation->keyFrames().clear();
-    m_xAnimation->keyFrames().push_back(KeyFrame<float>(0, m_owner->position().x));
-    m_xAnimation->keyFrames().push_back(KeyFrame<float>(1, target.x));
-
-    m_yAnimation->keyFrames().clear();
-    m_yAnimation->keyFrames().push_back(KeyFrame<float>(0, m_owner->position().y));
-    m_yAnimation->keyFrames().push_back(KeyFrame<float>(1, target.y));
-}
-
-void Bullet::start()
-{
-    m_startedInside = m_world->isInside(position());
-
-    float distance = hypot(position().x - m_target.x, position().y - m_target.y);
-
-    m_xAnimation->setIterations(1);
-    m_xAnimation->setDuration(distance / 750.);
-
-    m_yAnimation->setIterations(1);
-    m_yAnimation->setDuration(distance / 750.);
-
-    m_xAnimation->onCompleted.connect(m_xAnimation.get(), [=](){
-        if (m_yAnimation->isRunning()) {
-            return;
-        }
-        destroy();
-    });
-
-    m_yAnimation->onCompleted.connect(m_yAnimation.get(), [=](){
-        if (m_xAnimation->isRunning()) {
-            return;
-        }
-        destroy();
-    });
-
-    onXChanged.connect(this, [=]() { checkHit(); });
-    onYChanged.connect(this, [=]() { checkHit(); });
-
-    m_world->animationManager()->start(m_xAnimation);
-    m_world->animationManager()->start(m_yAnimation);
-
-    m_owner->addBullet(this);
-}
-
-void Bullet::checkHit()
-{
-    assert(m_world);
-    assert(m_owner);
-
-    if (m_world->isInside(position()) != m_startedInside) {
-        m_xAnimation->requestStop();
-        m_yAnimation->requestStop();
-        setColor(vec4(0, 0, 0, 0));
-        return;
-    }
-
-    shared_ptr<Player> target = m_world->getPlayerAt(position());
-    if (!target || target.get() == m_owner) {
-        return;
-    }
-
-    target->die();
-    m_xAnimation->requestStop();
-    m_yAnimation->requestStop();
-}
-
-json::JSON Bullet::serializeState() const
-{
-    json::JSON state;
-
-    state["id"] = id;
-    state["x"] = geometry().center().x;
-    state["y"] = geometry().center().y;
-    state["target_x"] = m_target.x;
-    state["target_y"] = m_target.y;
-
-    return state;
-}
-
-int Player::s_idCounter = 0;
-
-Player::Player(const vec4 color, GameWindow *world) :
-    id(s_idCounter++),
+Player::Player(World *world) :
+    id(world->nextPlayerId()),
     m_world(world),
-    m_color(color)
+    m_protocol(protocol::Text),
+    m_ackedTick(-1),
+    m_keyframeRequested(false),
+    m_droppedUpdates(0),
+    m_overflowedCommands(0)
 {
-    m_rootNode = Node::create();
-    *this << m_rootNode;
-
-    vec4 polygonColor = color;
-    polygonColor.w = 0.1;
-    m_polygon =  new PolygonNode(polygonColor);
-    m_polygon->setGeometry(rect2d::fromXywh(0, 0, m_world->size().x, m_world->size().y));
-    *m_rootNode << m_polygon;
-
-    m_posNode = TransformNode::create();
-    int wwidth = world->size().x;
-    int wheight = world->size().y;
-    m_position = vec2(rand() % wwidth / 2 + wwidth/4, rand() % wheight/2 + wheight/4);
-    m_posNode->setMatrix(mat4::translate2D(m_position));
-    *m_rootNode << m_posNode;
-
     m_rotation = 0;
-    m_rotateNode = TransformNode::create();
-    m_rotateNode->setMatrix(mat4::rotate2D(m_rotation));
-    *m_posNode << m_rotateNode;
-
-    RectangleNode *turretNode = RectangleNode::create(rect2d::fromXywh(std::hypot(PLAYER_WIDTH/2, PLAYER_HEIGHT/2),
-                                                                       -TURRET_HEIGHT/2,
-                                                                       TURRET_WIDTH, TURRET_HEIGHT), color);
-    *m_rotateNode << turretNode;
-
-//    m_playerNode = RectangleNode::create(rect2d::fromXywh(-PLAYER_WIDTH/2, -PLAYER_HEIGHT/2, PLAYER_WIDTH, PLAYER_HEIGHT), color);
-    m_playerNode = new PolygonNode(color);
-    m_playerNode->setGeometry(rect2d::fromXywh(-PLAYER_WIDTH/2, -PLAYER_HEIGHT/2, PLAYER_WIDTH, PLAYER_HEIGHT));
-
-    *m_posNode << m_playerNode;
-
-    m_xAnimation = make_shared<TransformXAnimation>(m_posNode);
-    m_xAnimation->setIterations(1);
-    m_xAnimation->setDuration(0.1);
-    m_yAnimation = make_shared<TransformYAnimation>(m_posNode);
-    m_yAnimation->setIterations(1);
-    m_yAnimation->setDuration(0.1);
-
-    m_nameNode = TextureNode::create();
-    *m_posNode << m_nameNode;
+    respawn();
+
     setName("Bot " + to_string(id));
 }
 
 Player::~Player()
 {
-    if (m_tcpConnection && m_tcpConnection->is_connected()) {
-        m_tcpConnection->disconnect(true);
+    const shared_ptr<Connection> connection = this->connection();
+    if (connection) {
+        connection->close();
     }
-}
 
-Node *Player::node()
-{
-    return m_rootNode;
+    // The bullets go with the World's BulletStore, which may already be gone
 }
 
-bool Player::handleEvent(Event *event)
+void Player::queueCommand(const Command &command)
 {
-    if (m_dead) {
-        return false;
-    }
-
-    // check if we're remote controlled
-    if (isActive()) {
-        return false;
-    }
-
-    string command;
-    vector<string> arguments;
-
-    switch(event->type()) {
-    case Event::PointerMove: {
-        vec2 cursorPos = PointerEvent::from(event)->position();
-        command = "POINT_AT";
-        arguments.push_back(to_string(cursorPos.x));
-        arguments.push_back(to_string(cursorPos.y));
-        break;
-    }
-    case Event::PointerDown: {
-        command = "FIRE";
-        break;
-    }
-    case Event::KeyDown: {
-        KeyEvent *keyEvent = KeyEvent::from(event);
-        switch(keyEvent->keyCode()) {
-        case KeyEvent::Key_Up:
-            command = "FORWARD";
-            break;
-        case KeyEvent::Key_Down:
-            command = "BACKWARD";
-            break;
-        case KeyEvent::Key_Left:
-            command = "STRAFE_LEFT";
-            break;
-        case KeyEvent::Key_Right:
-            command = "STRAFE_RIGHT";
-            break;
-        case KeyEvent::Key_Escape:
-            Backend::get()->quit();
-            return false;
-        case KeyEvent::Key_R:
-            m_position = vec2(rand() % int(m_world->size().x / 2) + m_world->size().y/4, rand() % int(m_world->size().x/2) + m_world->size().y/4);
-            m_posNode->setMatrix(mat4::translate2D(m_position));
-            m_playerNode->setColor(m_color);
-            reset();
-            return true;
-        default:
-            return false;
+    if (!m_commands.push(command)) {
+        // Way more than a bot can have applied before the next ticks
+        if (m_overflowedCommands++ == 0) {
+            cerr << m_name << " is sending commands faster than they are applied, dropping" << endl;
         }
-        break;
     }
+}
+
+// Moving and firing is limited to once per tick, like when only one command
+// was applied each tick, the rest only count against the budget.
+static bool isAction(const Command::Type type)
+{
+    switch(type) {
+    case Command::Fire:
+    case Command::Forward:
+    case Command::Backward:
+    case Command::StrafeLeft:
+    case Command::StrafeRight:
+        return true;
     default:
         return false;
     }
-
-    m_commandMutex.lock();
-    m_command = command;
-    m_arguments = arguments;
-    m_commandMutex.unlock();
-    return true;
-//    return handleCommand(command, arguments);
 }
 
-bool Player::handleCommand(const string &command, const vector<string> &arguments)
+bool Player::handleCommand(const Command &command)
 {
     if (m_dead) {
         return false;
     }
 
-    vec2 requestedPosition = m_position;
+    Vec2 requestedPosition = m_position;
 
     int horizontal = 0;
     int vertical = 0;
 
-    if (command == "NAME") {
-        if (arguments.size() != 1) {
-            cerr << "no name given to name command" << endl;
-            return false;
-        }
-        setName(arguments[0]);
-    } else if (command == "POINT_AT") {
-        if (arguments.size() != 2) {
-            cerr << "Invalid POINT_AT, no coordinates";
+    switch(command.type) {
+    case Command::Name:
+        setName(string(command.textView()));
+        break;
+    case Command::PointAt:
+        m_cursorPosition.x = command.x;
+        m_cursorPosition.y = command.y;
+        break;
+    case Command::Fire:
+        // Dropped, the counts in the frames can't hold more
+        if (m_world->bullets().size() >= protocol::maxBullets) {
             return false;
         }
-
-        m_cursorPosition.x = stof(arguments[0]);
-        m_cursorPosition.y = stof(arguments[1]);
-    } else if (command == "FIRE") {
-        Bullet *bullet = Bullet::create(this, m_cursorPosition, m_color);
-        *m_rootNode << bullet;
-        bullet->start();
+        m_bullets.push_back(m_world->bullets().fire(this, m_world->nextBulletId(), m_position, m_cursorPosition, m_world->isInside(m_position)));
         return true;
-    } else if (command == "STRAFE_LEFT") {
+    case Command::StrafeLeft:
         horizontal = -25;
-    } else if (command == "STRAFE_RIGHT") {
+        break;
+    case Command::StrafeRight:
         horizontal = 25;
-    } else if (command == "FORWARD") {
+        break;
+    case Command::Forward:
         vertical = 25;
-    } else if (command == "BACKWARD") {
+        break;
+    case Command::Backward:
         vertical = -25;
-    } else {
-        cerr << "unknown command '" << command << "'" << endl;
+        break;
+    default:
+        cerr << "unexpected command " << int(command.type) << endl;
         return false;
     }
 
@@ -309,71 +126,45 @@ bool Player::handleCommand(const string &command, const vector<string> &argument
     requestedPosition.x = std::max(requestedPosition.x, 0.f);
     requestedPosition.y = std::min(requestedPosition.y, m_world->size().y);
     requestedPosition.y = std::max(requestedPosition.y, 0.f);
-    mat4 translationMatrix = mat4::translate2D(requestedPosition.x, requestedPosition.y);
-
-    rect2d testRect = m_playerNode->geometry();
-    const mat4 rotationMatrix = mat4::rotate2D(rotation);
-
-    vec2 topLeft = testRect.tl;
-    vec2 bottomRight = testRect.br;
-    vec2 bottomLeft = vec2(topLeft.x, bottomRight.y);
-    vec2 topRight = vec2(bottomRight.x, topLeft.y);
-
-    topLeft     = rotationMatrix * topLeft;
-    topRight    = rotationMatrix * topRight;
-    bottomLeft  = rotationMatrix * bottomLeft;
-    bottomRight = rotationMatrix * bottomRight;
-
-    topLeft     = translationMatrix * topLeft;
-    topRight    = translationMatrix * topRight;
-    bottomLeft  = translationMatrix * bottomLeft;
-    bottomRight = translationMatrix * bottomRight;
 
     if (requestedPosition == m_position && rotation == m_rotation) {
         return false;
     }
 
-
-    m_xAnimation->keyFrames().clear();
-    m_xAnimation->keyFrames().push_back(KeyFrame<float>(0, m_position.x));
-    m_xAnimation->keyFrames().push_back(KeyFrame<float>(1, requestedPosition.x));
-    m_world->animationManager()->stop(m_xAnimation);
-    if (!m_xAnimation->isRunning()) {
-        m_world->animationManager()->start(m_xAnimation);
-    }
-
-    m_yAnimation->keyFrames().clear();
-    m_yAnimation->keyFrames().push_back(KeyFrame<float>(0, m_position.y));
-    m_yAnimation->keyFrames().push_back(KeyFrame<float>(1, requestedPosition.y));
-    m_world->animationManager()->stop(m_yAnimation);
-    if (!m_yAnimation->isRunning()) {
-        m_world->animationManager()->start(m_yAnimation);
+    if (requestedPosition != m_position) {
+        m_world->markPlayersChanged();
     }
 
     m_position = requestedPosition;
     m_rotation = rotation;
 
-    m_rotateNode->setMatrix(mat4::rotate2D(m_rotation));
-
     return true;
 }
 
-rect2d Player::geometry() const
+Rect Player::geometry() const
 {
     if (m_dead) {
-        return rect2d();
+        return Rect();
     }
 
-    assert(m_playerNode);
-    const rect2d orig = m_playerNode->geometry();
-    const mat4 matrix = TransformNode::matrixFor(m_playerNode, m_world->renderer()->sceneRoot());
-    return rect2d(matrix * orig.tl, matrix * orig.br).normalized();
+    return Rect::fromCenter(m_position, Vec2(PLAYER_WIDTH, PLAYER_HEIGHT));
+}
+
+void Player::respawn()
+{
+    const int wwidth = m_world->size().x;
+    const int wheight = m_world->size().y;
+    Random &random = m_world->random();
+    m_position = Vec2(random.bounded(wwidth) / 2 + wwidth/4, random.bounded(wheight) / 2 + wheight/4);
+    m_world->markPlayersChanged();
+
+    reset();
 }
 
 void Player::reset()
 {
     if (m_dead) {
-        *this << m_rootNode;
+        m_world->markPlayersChanged();
     }
 
     m_dead = false;
@@ -386,42 +177,58 @@ void Player::die()
     }
 
     m_dead = true;
-    remove(m_rootNode);
+    m_world->markPlayersChanged();
 }
 
-void Player::setTcpConnection(shared_ptr<tacopie::tcp_client> conn)
+void Player::setTcpConnection(shared_ptr<Connection> conn, const string &initialData)
 {
-    m_tcpConnection = conn;
+    shared_ptr<Connection> previous;
+    {
+        lock_guard<mutex> lock(m_sendMutex);
+        previous = move(m_tcpConnection);
+        m_tcpConnection = conn;
+        m_writesInFlight = 0;
+        m_pendingUpdate.reset();
+        m_pendingKeyframe = false;
+        m_statsInFlight = false;
+    }
+
+    // So it doesn't call us anymore
+    if (previous && previous != conn) {
+        previous->close();
+    }
 
     if (!conn) {
         cerr << "Handed null connection" << endl;
         return;
     }
 
-    tcp_client::read_request req;
-    req.size = 1024;
-    req.async_read_callback = [=](const tcp_client::read_result &result) {
-        this->onTcpMessage(result);
-    };
+    m_commandParser.feed(initialData.data(), initialData.size(), [this](const Command &command) {
+        handleNetworkCommand(command);
+    });
 
-    m_tcpConnection->async_read(req);
+    conn->setHandlers([this](const char *data, const size_t size) {
+        onTcpData(data, size);
+    }, [this]() {
+        onTcpClosed();
+    });
 }
 
 void Player::closeConnection()
 {
-    if (!isActive()) {
+    const shared_ptr<Connection> connection = this->connection();
+    if (!connection || !connection->isConnected()) {
         return;
     }
 
-    m_tcpConnection->disconnect();
-    for (Bullet *bullet : m_bullets) {
-        bullet->destroy();
-    }
+    connection->close();
+    removeBullets();
 }
 
 bool Player::isActive() const
 {
-    return m_tcpConnection && m_tcpConnection->is_connected();
+    const shared_ptr<Connection> connection = this->connection();
+    return connection && connection->isConnected();
 }
 
 bool Player::isAlive() const
@@ -429,19 +236,129 @@ bool Player::isAlive() const
     return !m_dead;
 }
 
-void Player::sendUpdate(const json::JSON &worldState) const
+void Player::sendUpdate(const shared_ptr<const Snapshot> &snapshot, const size_t index)
 {
+    if (!connection()) {
+        return;
+    }
+
+    const protocol::Protocol encoding = m_protocol;
+
+    // Delta against what the bot has acked, if we still have it
+    shared_ptr<const Snapshot> base;
+    if (encoding == protocol::Delta) {
+        const bool keyframeRequested = m_keyframeRequested.exchange(false);
+        const bool keyframeDue = snapshot->tick() - m_lastKeyframeTick >= protocol::keyframeInterval;
+        if (!keyframeRequested && !keyframeDue) {
+            base = m_world->snapshotAt(m_ackedTick);
+        }
+        if (!base) {
+            m_lastKeyframeTick = snapshot->tick();
+        }
+    }
+
+    shared_ptr<const UpdateMessage> message = make_shared<const UpdateMessage>(snapshot, index, encoding, base.get());
+
+    lock_guard<mutex> lock(m_sendMutex);
     if (!m_tcpConnection) {
         return;
     }
+    if (m_writesInFlight < maxWritesInFlight) {
+        m_writesInFlight++;
+        write(m_tcpConnection, move(message));
+        return;
+    }
 
-    json::JSON message;
-    message["type"] = "update";
-    message["you"] = serializeState();
-    message["world"] = worldState;
-    string serialized = message.dump(1, " ", " ") + "\n";
+    // Falling behind, only the newest state is worth sending
+    if (m_pendingUpdate) {
+        m_droppedUpdates++;
+        if (m_pendingKeyframe) {
+            m_keyframeRequested = true;
+        }
+    }
+    m_pendingUpdate = move(message);
+    m_pendingKeyframe = encoding == protocol::Delta && !base;
+}
 
-    m_tcpConnection->async_write({vector<char>(serialized.begin(), serialized.end()), nullptr});
+int Player::queuedUpdates() const
+{
+    lock_guard<mutex> lock(m_sendMutex);
+    return m_writesInFlight + (m_pendingUpdate ? 1 : 0);
+}
+
+void Player::sendStats()
+{
+    // One answer at a time, a bot asking faster than it reads them gets
+    // nothing for the ones in between instead of growing the write queue
+    {
+        lock_guard<mutex> lock(m_sendMutex);
+        if (!m_tcpConnection || m_statsInFlight) {
+            return;
+        }
+        m_statsInFlight = true;
+    }
+
+    const string json = "{\"type\":\"stats\"," + m_world->profiler().toJson().substr(1);
+
+    vector<char> buffer;
+    if (m_protocol == protocol::Text) {
+        buffer.assign(json.begin(), json.end());
+        buffer.push_back('\n');
+    } else {
+        protocol::Writer writer(&buffer);
+        const size_t frame = writer.beginFrame();
+        writer.u8(protocol::FrameStats);
+        buffer.insert(buffer.end(), json.begin(), json.end());
+        writer.endFrame(frame);
+    }
+
+    // Not an update, so it doesn't count against the writes in flight
+    lock_guard<mutex> lock(m_sendMutex);
+    if (!m_tcpConnection || !m_statsInFlight) {
+        // Reconnected in the meantime
+        return;
+    }
+    const shared_ptr<Connection> connection = m_tcpConnection;
+    const bool written = connection->write(move(buffer), [=]() {
+        lock_guard<mutex> lock(m_sendMutex);
+        if (connection == m_tcpConnection) {
+            m_statsInFlight = false;
+        }
+    });
+    if (written) {
+        m_statsInFlight = false;
+    }
+}
+
+void Player::write(const shared_ptr<Connection> &connection, shared_ptr<const UpdateMessage> message)
+{
+    // Written straight from the shared snapshot, which the message keeps
+    // alive until the connection is done with it
+    const vector<Snapshot::Slice> &slices = message->slices();
+    const bool written = connection->write(slices, move(message), [=]() {
+        this->onWriteDone(connection);
+    });
+
+    // Straight to the socket, so it isn't in flight anymore
+    if (written) {
+        m_writesInFlight--;
+    }
+}
+
+void Player::onWriteDone(const shared_ptr<Connection> &connection)
+{
+    lock_guard<mutex> lock(m_sendMutex);
+    if (connection != m_tcpConnection) {
+        // From before a reconnect
+        return;
+    }
+    if (!m_pendingUpdate) {
+        m_writesInFlight--;
+        return;
+    }
+
+    m_pendingKeyframe = false;
+    write(connection, move(m_pendingUpdate));
 }
 
 json::JSON Player::serializeState() const
@@ -458,9 +375,9 @@ json::JSON Player::serializeState() const
 
     // TODO: only show visible bullets?
     json::JSON bullets = json::Array();
-    for (Bullet *bullet : m_bullets) {
-        bullets.append(bullet->serializeState());
-    }
+    forEachBullet([&](const Bullet &bullet) {
+        bullets.append(bullet.serializeState());
+    });
     state["bullets"] = move(bullets);
 
     return state;
@@ -468,26 +385,37 @@ json::JSON Player::serializeState() const
 
 void Player::update()
 {
+    // Whatever a dead player sends is thrown away, instead of filling up the
+    // queue and being applied when the player is reset for the next game
     if (!isAlive()) {
+        while (m_commands.front()) {
+            m_commands.pop();
+        }
         return;
     }
 
-    m_commandMutex.lock();
-    if (!m_command.empty()) {
-        handleCommand(m_command, m_arguments);
+    // The rest wait for the next tick, in order
+    bool acted = false;
+    for (int i=0; i<m_world->commandBudget(); i++) {
+        Command *command = m_commands.front();
+        if (!command) {
+            break;
+        }
+        if (isAction(command->type)) {
+            if (acted) {
+                break;
+            }
+            acted = true;
+        }
+        m_world->recordCommand(id, *command);
+        handleCommand(*command);
+        m_commands.pop();
     }
-    m_command.clear();
-    m_arguments.clear();
-    m_commandMutex.unlock();
 }
 
 void Player::setName(const string &name)
 {
     m_name = name;
-    m_nameJob = std::make_shared<GlyphTextureJob>(m_world->font(), name, Units(m_world).font());
-    world()->workQueue()->schedule(m_nameJob);
-
-    requestPreprocess();
 }
 
 vector<int> Player::visiblePlayerIds() const
@@ -495,262 +423,119 @@ vector<int> Player::visiblePlayerIds() const
     return m_visiblePlayers;
 }
 
-void Player::addBullet(Bullet *bullet)
+void Player::forEachBullet(const function<void(const Bullet &bullet)> &callback) const
 {
-    m_bullets.insert(bullet);
+    const BulletStore &store = m_world->bullets();
+    for (const BulletHandle &handle : m_bullets) {
+        callback(Bullet(store, store.indexOf(handle)));
+    }
 }
 
-void Player::removeBullet(Bullet *bullet)
+void Player::pruneBullets()
 {
-    m_bullets.erase(bullet);
-
+    const BulletStore &store = m_world->bullets();
+    m_bullets.erase(remove_if(m_bullets.begin(), m_bullets.end(), [&](const BulletHandle &handle) {
+        return !store.contains(handle);
+    }), m_bullets.end());
 }
 
-void Player::onPreprocess()
+void Player::removeBullets()
 {
-    if (m_nameJob) {
-        if (m_nameJob->hasCompleted()) {
-            Texture *t = m_world->renderer()->createTextureFromImageData(m_nameJob->textureSize(), Texture::RGBA_32, m_nameJob->textureData());
-            const vec2 size = t->size();
-            const vec2 pos(-size.x/2, 10);
-            m_nameNode->setTexture(t);
-            m_nameNode->setGeometry(rect2d::fromPosSize(pos, t->size()));
-
-            m_nameJob.reset();
-        } else {
-            requestPreprocess();
-        }
-    }
-
-    const float radius = PLAYER_HEIGHT;
-    const float cx = geometry().center().x;
-    const float cy = geometry().center().y;
-
-    vector<vec2> points;
-    for (int i=0; i<6; i++) {
-        float x = cos(i * M_PI / 3. + M_PI_2) * radius + cx;
-        float y = sin(i * M_PI / 3. + M_PI_2) * radius + cy;
-        points.push_back({x, y});
+    BulletStore &store = m_world->bullets();
+    for (const BulletHandle &handle : m_bullets) {
+        store.remove(handle);
     }
-
-    m_playerNode->setPoints(points);
-
-    updateVisibility();
-    requestPreprocess();
+    m_bullets.clear();
 }
 
-void Player::onTcpMessage(const tcp_client::read_result &res)
+void Player::onTcpData(const char *data, const size_t size)
 {
-    if (!res.success) {
-        cerr << "Error when reading" << endl;
-        m_tcpConnection.reset();
-        return;
-    }
-
-    // Make sure we read more
-    if (m_tcpConnection) {
-        tcp_client::read_request req;
-        req.size = 1024;
-        req.async_read_callback = [=](const tcp_client::read_result &result){
-            this->onTcpMessage(result);
-        };
-
-        m_tcpConnection->async_read(req);
-    }
-
-    m_networkBuffer += std::string(res.buffer.begin(), res.buffer.end());
-
-    string::size_type lastNewline = m_networkBuffer.rfind("\n");
-    if (lastNewline == string::npos) {
-        // No newline yet, hopefully comes in next packet
-        return;
-    }
+    m_commandParser.feed(data, size, [this](const Command &command) {
+        handleNetworkCommand(command);
+    });
+}
 
+void Player::onTcpClosed()
+{
+    cerr << "Error when reading" << endl;
+    lock_guard<mutex> lock(m_sendMutex);
+    m_tcpConnection.reset();
+}
 
-    string::size_type prevNewline = m_networkBuffer.rfind("\n", lastNewline - 1);
-    if (prevNewline == string::npos) {
-        prevNewline = 0;
-    }
-    string line = m_networkBuffer.substr(prevNewline, lastNewline);
+shared_ptr<Connection> Player::connection() const
+{
+    lock_guard<mutex> lock(m_sendMutex);
+    return m_tcpConnection;
+}
 
-    vector<string> arguments;
-    istringstream stream(line);
-    string argument;
-    string command;
-    while (getline(stream, argument, ' ')) {
-        if (command.empty()) {
-            command = argument;
+void Player::handleNetworkCommand(const Command &command)
+{
+    // Handled right away, they decide how the next update is encoded
+    switch(command.type) {
+    case Command::Protocol:
+        if (command.textView() == "BINARY") {
+            m_protocol = protocol::Binary;
+        } else if (command.textView() == "TEXT") {
+            m_protocol = protocol::Text;
+        } else if (command.textView() == "DELTA") {
+            m_ackedTick = -1;
+            m_protocol = protocol::Delta;
         } else {
-            arguments.push_back(argument);
+            cerr << "Invalid PROTOCOL, expected BINARY, TEXT or DELTA" << endl;
         }
+        break;
+    case Command::Ack:
+        m_ackedTick = command.tick;
+        break;
+    case Command::Keyframe:
+        m_keyframeRequested = true;
+        break;
+    case Command::Stats:
+        sendStats();
+        break;
+    default:
+        queueCommand(command);
+        break;
     }
-
-    if (arguments.empty()) {
-        command = line;
-    }
-
-    if (lastNewline == m_networkBuffer.size() - 1) {
-        m_networkBuffer.clear();
-    } else {
-        m_networkBuffer = m_networkBuffer.substr(lastNewline);
-    }
-
-    m_commandMutex.lock();
-    m_arguments = arguments;
-    m_command = command;
-    m_commandMutex.unlock();
-
-    requestPreprocess();
-    m_world->requestRender();
 }
 
-struct Line {
-    Line(vec2 p1, vec2 p2) : a(p1), b(p2), dx(p2.x - p1.x), dy(p2.y - p1.y), magnitude(hypot(dx, dy)) { }
-
-    Line() = default;
-
-    const vec2 a;
-    const vec2 b;
-
-    const float dx = 0;
-    const float dy = 0;
-    const float magnitude = 0;
-
-    float startAngle = 0;
-    float endAngle = 0;
-
-    struct Intersection
-    {
-        Intersection() = default;
-        Intersection(float x_, float y_, float d) : x(x_), y(y_), distance(d), valid(true) {}
-
-        operator bool() const { return valid; }
-        operator vec2() const { return vec2(x, y); }
-        bool operator<(const Intersection &other) const { return distance < other.distance; }
-
-    private:
-        float x = 0, y = 0, distance = 0.;
-        bool valid = false;
-    };
-
-    Intersection intersection(const Line &other) const {
-        // check if we're parallel
-        if (dx / magnitude == other.dx / other.magnitude &&
-            dy / magnitude == other.dy / other.magnitude) {
-            return Intersection();
-        }
-
-        const float otherLength = (dx*(other.a.y - a.y) + dy * (a.x - other.a.x)) / (other.dx*dy - other.dy*dx);
-        const float distance = (other.a.x + other.dx * otherLength-a.x) / dx;
-
-        if (distance < 0) {
-            return Intersection();
-        }
-
-        if (otherLength < 0 || otherLength > 1) {
-            return Intersection();
-        }
-
-        return Intersection(a.x + dx * distance, a.y + dy * distance, distance);
-    }
-};
-
 void Player::updateVisibility()
 {
-    vec2 playerCenter = m_posNode->matrix() * m_playerNode->geometry().center();
-
-    vector<rect2d> rectangles = m_world->rectangles();
-    rectangles.push_back(rect2d(0, 0, m_world->size().x, m_world->size().y)); // add borders of the map
-
-    vector<float> angles;
-    vector<Line> segments;
-    for (const rect2d &block : rectangles) {
-        const vec2 topLeft (block.tl);
-        float angle = atan2(topLeft.y - playerCenter.y, topLeft.x - playerCenter.x);
-        angles.push_back(angle - 0.0001);
-        angles.push_back(angle);
-        angles.push_back(angle + 0.0001);
-
-        const vec2 bottomRight (block.br);
-        angle = atan2(bottomRight.y - playerCenter.y, bottomRight.x - playerCenter.x);
-        angles.push_back(angle - 0.0001);
-        angles.push_back(angle);
-        angles.push_back(angle + 0.0001);
-
-        const vec2 bottomLeft (vec2(topLeft.x, bottomRight.y));
-        angle = atan2(bottomLeft.y - playerCenter.y, bottomLeft.x - playerCenter.x);
-        angles.push_back(angle - 0.0001);
-        angles.push_back(angle);
-        angles.push_back(angle + 0.0001);
-
-        const vec2 topRight (vec2(bottomRight.x, topLeft.y));
-        angle = atan2(topRight.y - playerCenter.y, topRight.x - playerCenter.x);
-        angles.push_back(angle - 0.0001);
-        angles.push_back(angle);
-        angles.push_back(angle + 0.0001);
-
-        segments.push_back(Line(topLeft, topRight));
-        segments.push_back(Line(bottomLeft, bottomRight));
-        segments.push_back(Line(topLeft, bottomLeft));
-        segments.push_back(Line(topRight, bottomRight));
-    }
-
-    // Find visible players
-    m_visiblePlayers.clear();
+    const Vec2 playerCenter = m_position;
 
-    const vector<shared_ptr<Player>> otherPlayers = m_world->players(id);
-    for (const shared_ptr<Player> &otherPlayer : otherPlayers) {
-        const vec2 otherPos = otherPlayer->geometry().center();
-        const float angle = atan2(otherPos.y - playerCenter.y, otherPos.x - playerCenter.x);
-        Line ray(playerCenter, vec2(playerCenter.x + cos(angle), playerCenter.y + sin(angle)));
+    const bool polygonChanged = playerCenter != m_visibilityCenter ||
+                                m_world->obstacleRevision() != m_visibilityObstacleRevision;
 
-        bool isBlocked = false;
-        for (const Line &segment : segments) {
-            const Line::Intersection intersection = ray.intersection(segment);
-
-            if (intersection) {
-                isBlocked = true;
-                break;
-            }
-        }
-
-        if (!isBlocked) {
-            m_visiblePlayers.push_back(otherPlayer->id);
-        }
+    if (!polygonChanged && m_world->playersRevision() == m_visiblePlayersRevision) {
+        return;
     }
 
-    // Find visible regions
-    std::sort(angles.begin(), angles.end());
-
-    vector<vec2> points;
-    points.push_back(playerCenter);
-    for (const float angle : angles) {
-        Line ray(playerCenter, vec2(playerCenter.x + cos(angle), playerCenter.y + sin(angle)));
-
-        Line::Intersection closestIntersection;
-        for (const Line &segment : segments) {
-            const Line::Intersection intersection = ray.intersection(segment);
-
-            if (!intersection) {
-                continue;
-            }
-
-            if (intersection < closestIntersection || !closestIntersection) {
-                closestIntersection = intersection;
-            }
-        }
-
-        if (!closestIntersection) {
-            continue;
+    if (polygonChanged) {
+        computeVisibility(playerCenter, m_world->segmentBuffer(), m_world->segmentCrossings(), &m_visibilityPolygon);
+        m_visibilityBounds = Rect(playerCenter, playerCenter);
+        for (const Vec2 &point : m_visibilityPolygon) {
+            m_visibilityBounds.tl.x = min(m_visibilityBounds.tl.x, point.x);
+            m_visibilityBounds.tl.y = min(m_visibilityBounds.tl.y, point.y);
+            m_visibilityBounds.br.x = max(m_visibilityBounds.br.x, point.x);
+            m_visibilityBounds.br.y = max(m_visibilityBounds.br.y, point.y);
         }
-
-        points.push_back(closestIntersection);
+        m_visibilityCenter = playerCenter;
+        m_visibilityObstacleRevision = m_world->obstacleRevision();
+        m_visibilityRevision++;
     }
 
-    if (points.size() < 3) {
-        return;
-    }
-    points.push_back(points[1]); // complete it
-    m_polygon->setPoints(points);
+    m_visiblePlayersRevision = m_world->playersRevision();
 
+    // Only players the grid has near the polygon need checking, each with one
+    // ray that is blocked if it hits a segment before getting to them
+    const SegmentBuffer &segments = m_world->segmentBuffer();
+    m_visiblePlayers.clear();
+    m_world->queryPlayers(m_visibilityBounds, [&](const shared_ptr<Player> &otherPlayer) {
+        if (otherPlayer->id != id && otherPlayer->isAlive() &&
+            segments.nearest(playerCenter, otherPlayer->position() - playerCenter) >= 1) {
+            m_visiblePlayers.push_back(otherPlayer->id);
+        }
+        return false;
+    });
+    sort(m_visiblePlayers.begin(), m_visiblePlayers.end());
 }
@@ -1,146 +1,148 @@
 #ifndef PLAYER_H
 #define PLAYER_H
 
-#include "rengine.h"
-#include <set>
+#include "bulletstore.h"
+#include "commandqueue.h"
+#include "connection.h"
+#include "geometry.h"
+#include "protocol.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
-#include <tacopie/network/tcp_client.hpp>
 #include <SimpleJSON/json.hpp>
 
-class PolygonNode;
-class GameWindow;
+class World;
+class Snapshot;
+class UpdateMessage;
 class Player;
-class Bullet;
 
-using namespace rengine;
 using namespace std;
 
-using tacopie::tcp_client;
+#define PLAYER_WIDTH 20
+#define PLAYER_HEIGHT 20
 
-typedef Animation<RectangleNodeBase, float, &RectangleNodeBase::setX, &AnimationCurves::linear> RectangleXAnimation;
-typedef Animation<RectangleNodeBase, float, &RectangleNodeBase::setY, &AnimationCurves::linear> RectangleYAnimation;
-typedef Animation<TransformNode, float, &TransformNode::setMatrix_x, &AnimationCurves::linear> TransformXAnimation;
-typedef Animation<TransformNode, float, &TransformNode::setMatrix_y, &AnimationCurves::linear> TransformYAnimation;
-
-class Player : public Node
+class Player
 {
 public:
-    static int s_idCounter;
-
     const int id;
 
     Player() = delete;
     Player(const Player &) = delete;
 
-    Player(const vec4 color, GameWindow *world);
+    Player(World *world);
     ~Player();
 
-    Node *node();
+    bool handleCommand(const Command &command);
 
-    bool handleEvent(Event *event);
+    // For local (non-network) control, applied on the next tick like the network commands
+    void queueCommand(const Command &command);
 
-    bool handleCommand(const string &command, const vector<string> &arguments);
+    // Commands that did not fit in the queue
+    uint64_t overflowedCommands() const { return m_overflowedCommands; }
 
-    GameWindow *world() { return m_world; }
+    World *world() { return m_world; }
+    const World *world() const { return m_world; }
 
-    vec2 position() const { return m_position; }
-    rect2d geometry() const;
+    Vec2 position() const { return m_position; }
+    Vec2 cursorPosition() const { return m_cursorPosition; }
+    float rotation() const { return m_rotation; }
+    Rect geometry() const;
 
+    void respawn();
     void reset();
     void die();
-    void setTcpConnection(shared_ptr<tcp_client> conn);
+    // initialData is anything already read from the connection
+    void setTcpConnection(shared_ptr<Connection> conn, const string &initialData = string());
     void closeConnection();
 
     bool isActive() const;
     bool isAlive() const;
 
-    void sendUpdate(const json::JSON &worldState) const;
+    // index is where this player is in the snapshot (World::allPlayers() order)
+    void sendUpdate(const shared_ptr<const Snapshot> &snapshot, const size_t index);
+    protocol::Protocol protocol() const { return m_protocol; }
+
+    // A bot that reads slowly only ever has maxWritesInFlight updates queued
+    // in the connection plus the newest one waiting, older ones are dropped.
+    static constexpr int maxWritesInFlight = 2;
+    int queuedUpdates() const;
+    uint64_t droppedUpdates() const { return m_droppedUpdates; }
 
     json::JSON serializeState() const;
 
     void update();
+    void updateVisibility();
 
     const std::string &name() const { return m_name; }
     void setName(const string &name);
 
     vector<int> visiblePlayerIds() const;
+    const vector<Vec2> &visibilityPolygon() const { return m_visibilityPolygon; }
+    int visibilityRevision() const { return m_visibilityRevision; }
 
-    void addBullet(Bullet *bullet);
-    void removeBullet(Bullet *bullet);
-
-protected:
-    void onPreprocess() override;
+    // In the World's BulletStore, in the order they were fired
+    const vector<BulletHandle> &bullets() const { return m_bullets; }
+    void forEachBullet(const function<void(const Bullet &bullet)> &callback) const;
+    // Forgets the ones the store has removed since
+    void pruneBullets();
+    void removeBullets();
 
 private:
-    void onTcpMessage(const tcp_client::read_result& res);
-    void updateVisibility();
+    friend class Replay;
+    friend class ReplayRecorder;
+
+    void onTcpData(const char *data, const size_t size);
+    void onTcpClosed();
+    // m_tcpConnection is replaced from the network threads, so anything else
+    // works on a copy of it
+    shared_ptr<Connection> connection() const;
 
-    Node *m_rootNode = nullptr;
-    TransformNode *m_posNode = nullptr;
-    TransformNode *m_rotateNode = nullptr;
-    PolygonNode *m_playerNode = nullptr;
     float m_rotation;
-    vec2 m_position;
-    vec2 m_cursorPosition;
-    PolygonNode *m_polygon = nullptr;
-    GameWindow *m_world = nullptr;
-    vec4 m_color;
-    shared_ptr<tcp_client> m_tcpConnection;
-    string m_networkBuffer;
+    Vec2 m_position;
+    Vec2 m_cursorPosition;
+    World *m_world = nullptr;
+    shared_ptr<Connection> m_tcpConnection;
+    CommandParser m_commandParser;
+    atomic<protocol::Protocol> m_protocol;
+
+    // PROTOCOL DELTA state, the acks come in on the network thread
+    atomic<long> m_ackedTick;
+    atomic<bool> m_keyframeRequested;
+    long m_lastKeyframeTick = 0;
+
+    void write(const shared_ptr<Connection> &connection, shared_ptr<const UpdateMessage> message);
+    void onWriteDone(const shared_ptr<Connection> &connection);
+
+    mutable mutex m_sendMutex;
+    int m_writesInFlight = 0;
+    shared_ptr<const UpdateMessage> m_pendingUpdate;
+    bool m_pendingKeyframe = false;
+    atomic<uint64_t> m_droppedUpdates;
     bool m_dead = false;
 
-    mutex m_commandMutex;
-    string m_command;
-    vector<string> m_arguments;
+    void handleNetworkCommand(const Command &command);
+    // Answers STATS, outside the update stream
+    void sendStats();
+    bool m_statsInFlight = false;
 
+    CommandQueue m_commands;
+    atomic<uint64_t> m_overflowedCommands;
 
-    TextureNode *m_nameNode;
-    shared_ptr<TransformXAnimation> m_xAnimation;
-    shared_ptr<TransformYAnimation> m_yAnimation;
     vector<int> m_visiblePlayers;
-    set<Bullet*> m_bullets;
-
-    std::shared_ptr<GlyphTextureJob> m_nameJob;
+    vector<Vec2> m_visibilityPolygon;
+    Rect m_visibilityBounds;
+    Vec2 m_visibilityCenter;
+    int m_visibilityRevision = 0;
+    int m_visibilityObstacleRevision = -1;
+    int m_visiblePlayersRevision = -1;
+    vector<BulletHandle> m_bullets;
 
     std::string m_name;
 };
 
-class Bullet : public RectangleNode
-{
-public:
-    static int s_idCounter;
-    const int id;
-
-    Bullet();
-    ~Bullet();
-
-    RENGINE_ALLOCATION_POOL_DECLARATION(Bullet, BulletNode);
-
-    void setOwner(Player *owner);
-    void setTarget(vec2 target);
-    void start();
-    void checkHit();
-
-    static Bullet *create(Player *owner, vec2 target, vec4 color) {
-
-        Bullet *node = create();
-        node->setOwner(owner);
-        node->setTarget(target);
-        node->setColor(color);
-        node->setGeometry(rect2d::fromPosSize(owner->position() - vec2(3, 3), vec2(6, 6)));
-
-        return node;
-    }
-
-    json::JSON serializeState() const;
-
-private:
-    Player *m_owner = nullptr;
-    GameWindow *m_world = nullptr;
-    shared_ptr<RectangleXAnimation> m_xAnimation;
-    shared_ptr<RectangleYAnimation> m_yAnimation;
-    vec2 m_target;
-    bool m_startedInside;
-};
-
 #endif // PLAYER_H
@@ -0,0 +1,147 @@
+#include "playernode.h"
+
+#include "gamewindow.h"
+#include "player.h"
+#include "polygonbatchnode.h"
+
+#include <cmath>
+
+#ifndef M_PI_2
+// fucking wintendo
+#define M_PI_2		1.57079632679489661923
+#endif
+
+#define TURRET_WIDTH 14
+#define TURRET_HEIGHT 14
+
+PlayerNode::PlayerNode(const SceneState::PlayerState &player, const vec4 color, GameWindow *window) :
+    m_window(window),
+    m_color(color)
+{
+    m_rootNode = Node::create();
+    *this << m_rootNode;
+
+    vec4 polygonColor = color;
+    polygonColor.w = 0.1;
+    m_visibilityPolygon = m_window->visibilityLayer()->addPolygon(polygonColor);
+    m_bodyPolygon = m_window->bodyLayer()->addPolygon(color);
+
+    m_posNode = TransformNode::create();
+    m_position = toVec2(player.position);
+    m_fromPosition = m_position;
+    m_toPosition = m_position;
+    m_posNode->setMatrix(mat4::translate2D(m_position));
+    *m_rootNode << m_posNode;
+
+    m_rotation = player.rotation;
+    m_fromRotation = m_rotation;
+    m_toRotation = m_rotation;
+    m_rotateNode = TransformNode::create();
+    m_rotateNode->setMatrix(mat4::rotate2D(m_rotation));
+    *m_posNode << m_rotateNode;
+
+    RectangleNode *turretNode = RectangleNode::create(rect2d::fromXywh(std::hypot(PLAYER_WIDTH/2, PLAYER_HEIGHT/2),
+                                                                       -TURRET_HEIGHT/2,
+                                                                       TURRET_WIDTH, TURRET_HEIGHT), color);
+    *m_rotateNode << turretNode;
+
+    m_nameNode = TextureNode::create();
+    *m_posNode << m_nameNode;
+
+    sync(player);
+    updateBody();
+}
+
+void PlayerNode::sync(const SceneState::PlayerState &player)
+{
+    if (player.alive == m_dead) {
+        m_dead = !player.alive;
+        if (m_dead) {
+            remove(m_rootNode);
+        } else {
+            *this << m_rootNode;
+        }
+        m_window->visibilityLayer()->setVisible(m_visibilityPolygon, !m_dead);
+        m_window->bodyLayer()->setVisible(m_bodyPolygon, !m_dead);
+    }
+
+    if (player.name != m_name) {
+        m_name = player.name;
+        m_nameJob = std::make_shared<GlyphTextureJob>(m_window->font(), m_name, Units(m_window).font());
+        m_window->workQueue()->schedule(m_nameJob);
+        requestPreprocess();
+    }
+
+    const vec2 position = toVec2(player.position);
+    m_fromPosition = m_position;
+    m_toPosition = position;
+
+    // Respawned, so no sliding across the map
+    if (std::hypot(position.x - m_position.x, position.y - m_position.y) > PLAYER_WIDTH * 5) {
+        m_fromPosition = position;
+    }
+
+    // The short way around
+    m_fromRotation = m_rotation;
+    m_toRotation = m_rotation + std::remainder(player.rotation - m_rotation, float(2 * M_PI));
+
+    if (player.visibilityRevision != m_visibilityRevision && player.visibility) {
+        m_visibilityRevision = player.visibilityRevision;
+
+        const vector<Vec2> &visibility = *player.visibility;
+        vector<vec2> points;
+        points.reserve(visibility.size());
+        for (const Vec2 &point : visibility) {
+            points.push_back(toVec2(point));
+        }
+        m_window->visibilityLayer()->setPoints(m_visibilityPolygon, points);
+    }
+}
+
+void PlayerNode::interpolate(const float progress)
+{
+    const vec2 position = m_fromPosition + (m_toPosition - m_fromPosition) * progress;
+    if (position != m_position) {
+        m_position = position;
+        m_posNode->setMatrix(mat4::translate2D(m_position));
+        updateBody();
+    }
+
+    const float rotation = m_fromRotation + (m_toRotation - m_fromRotation) * progress;
+    if (rotation != m_rotation) {
+        m_rotation = rotation;
+        m_rotateNode->setMatrix(mat4::rotate2D(m_rotation));
+    }
+}
+
+void PlayerNode::onPreprocess()
+{
+    if (m_nameJob) {
+        if (m_nameJob->hasCompleted()) {
+            Texture *t = m_window->renderer()->createTextureFromImageData(m_nameJob->textureSize(), Texture::RGBA_32, m_nameJob->textureData());
+            const vec2 size = t->size();
+            const vec2 pos(-size.x/2, 10);
+            m_nameNode->setTexture(t);
+            m_nameNode->setGeometry(rect2d::fromPosSize(pos, t->size()));
+
+            m_nameJob.reset();
+        } else {
+            requestPreprocess();
+        }
+    }
+}
+
+// The layers draw in scene coordinates, and nothing above the player moves it
+void PlayerNode::updateBody()
+{
+    const float radius = PLAYER_HEIGHT;
+    vector<vec2> points;
+    points.reserve(6);
+    for (int i=0; i<6; i++) {
+        float x = cos(i * M_PI / 3. + M_PI_2) * radius + m_position.x;
+        float y = sin(i * M_PI / 3. + M_PI_2) * radius + m_position.y;
+        points.push_back({x, y});
+    }
+
+    m_window->bodyLayer()->setPoints(m_bodyPolygon, points);
+}
@@ -0,0 +1,62 @@
+#ifndef PLAYERNODE_H
+#define PLAYERNODE_H
+
+#include "geometry.h"
+#include "simulation.h"
+
+#include "rengine.h"
+
+class GameWindow;
+
+using namespace rengine;
+using namespace std;
+
+inline vec2 toVec2(const Vec2 &v) { return vec2(v.x, v.y); }
+
+// Draws a simulated Player. Moves from where it was shown when the last state
+// came towards that state, as the window tells it how far along it is.
+class PlayerNode : public Node
+{
+public:
+    PlayerNode(const SceneState::PlayerState &player, const vec4 color, GameWindow *window);
+
+    void sync(const SceneState::PlayerState &player);
+
+    // 0 is where it was when synced, 1 is the synced state
+    void interpolate(const float progress);
+
+    const vec4 &color() const { return m_color; }
+
+protected:
+    void onPreprocess() override;
+
+private:
+    void updateBody();
+
+    GameWindow *m_window;
+
+    Node *m_rootNode = nullptr;
+    TransformNode *m_posNode = nullptr;
+    TransformNode *m_rotateNode = nullptr;
+    // In the window's polygon layers
+    int m_bodyPolygon = -1;
+    int m_visibilityPolygon = -1;
+    TextureNode *m_nameNode = nullptr;
+    vec4 m_color;
+
+    // What is shown, and where it goes from and to
+    vec2 m_position;
+    vec2 m_fromPosition;
+    vec2 m_toPosition;
+    float m_rotation = 0;
+    float m_fromRotation = 0;
+    float m_toRotation = 0;
+
+    bool m_dead = false;
+    string m_name;
+    int m_visibilityRevision = -1;
+
+    std::shared_ptr<GlyphTextureJob> m_nameJob;
+};
+
+#endif // PLAYERNODE_H
@@ -0,0 +1,175 @@
+#include "polygonbatchnode.h"
+
+#include <algorithm>
+#include <cstddef>
+
+static const char *vertexShader =
+        "attribute vec2 aV;\n"
+        "attribute vec4 aC;\n"
+        "uniform mat4 m;\n"
+        "varying vec4 vC;\n"
+        "void main() {\n"
+        "    gl_Position = m * vec4(aV, 0, 1);\n"
+        "    vC = aC;\n"
+        "}\n";
+
+static const char *fragmentShader =
+        "#ifdef GL_ES\n"
+        "precision mediump float;\n"
+        "#endif\n"
+        "varying vec4 vC;\n"
+        "void main() {\n"
+        "    gl_FragColor = vC;\n"
+        "}\n";
+
+static const size_t maxBatchVertices = 65536;
+
+PolygonBatchNode::PolygonBatchNode()
+{
+    std::vector<const char *> attrsV;
+    attrsV.push_back("aV");
+    attrsV.push_back("aC");
+
+    m_shaderProgram.initialize(vertexShader, fragmentShader, attrsV);
+    m_shaderProgram.matrix = m_shaderProgram.resolve("m");
+
+    glGenBuffers(1, &m_vertexBuffer);
+    glGenBuffers(1, &m_indexBuffer);
+}
+
+PolygonBatchNode::~PolygonBatchNode()
+{
+    glDeleteBuffers(1, &m_vertexBuffer);
+    glDeleteBuffers(1, &m_indexBuffer);
+}
+
+int PolygonBatchNode::addPolygon(const vec4 &color)
+{
+    m_polygons.emplace_back();
+    setColor(m_polygons.size() - 1, color);
+    return m_polygons.size() - 1;
+}
+
+void PolygonBatchNode::setPoints(const int polygon, const vector<vec2> &points)
+{
+    // Same size every time for the bodies, so this doesn't allocate
+    m_polygons[polygon].points.assign(points.begin(), points.end());
+    m_dirty = true;
+}
+
+void PolygonBatchNode::setColor(const int polygon, const vec4 &color)
+{
+    uint8_t *target = m_polygons[polygon].color;
+    target[0] = uint8_t(color.x * color.w * 255);
+    target[1] = uint8_t(color.y * color.w * 255);
+    target[2] = uint8_t(color.z * color.w * 255);
+    target[3] = uint8_t(color.w * 255);
+    m_dirty = true;
+}
+
+void PolygonBatchNode::setVisible(const int polygon, const bool visible)
+{
+    if (m_polygons[polygon].visible == visible) {
+        return;
+    }
+    m_polygons[polygon].visible = visible;
+    m_dirty = true;
+}
+
+void PolygonBatchNode::upload()
+{
+    m_vertices.clear();
+    m_indices.clear();
+    m_batches.assign(1, Batch());
+
+    for (const Polygon &polygon : m_polygons) {
+        if (!polygon.visible || polygon.points.size() < 3) {
+            continue;
+        }
+        const size_t count = std::min(polygon.points.size(), maxBatchVertices);
+
+        if (m_vertices.size() - m_batches.back().firstVertex + count > maxBatchVertices) {
+            Batch batch;
+            batch.firstVertex = m_vertices.size();
+            batch.firstIndex = m_indices.size();
+            m_batches.push_back(batch);
+        }
+
+        const size_t first = m_vertices.size() - m_batches.back().firstVertex;
+        for (size_t i=0; i<count; i++) {
+            Vertex vertex;
+            vertex.position = polygon.points[i];
+            std::copy(polygon.color, polygon.color + 4, vertex.color);
+            m_vertices.push_back(vertex);
+        }
+
+        // The fan, as separate triangles
+        for (size_t i=1; i<count - 1; i++) {
+            m_indices.push_back(first);
+            m_indices.push_back(first + i);
+            m_indices.push_back(first + i + 1);
+        }
+        m_batches.back().indexCount = m_indices.size() - m_batches.back().firstIndex;
+    }
+
+    if (m_vertices.empty()) {
+        return;
+    }
+
+    // Orphan the old storage instead of waiting for the GPU to finish with
+    // it, and only grow it when it doesn't fit
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    if (m_vertices.size() > m_vertexCapacity) {
+        m_vertexCapacity = std::max(m_vertices.size(), m_vertexCapacity * 2);
+    }
+    glBufferData(GL_ARRAY_BUFFER, m_vertexCapacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, m_vertices.size() * sizeof(Vertex), m_vertices.data());
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+    if (m_indices.size() > m_indexCapacity) {
+        m_indexCapacity = std::max(m_indices.size(), m_indexCapacity * 2);
+    }
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indexCapacity * sizeof(uint16_t), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, m_indices.size() * sizeof(uint16_t), m_indices.data());
+}
+
+void PolygonBatchNode::render(const mat4 &proj)
+{
+    if (m_dirty) {
+        upload();
+        m_dirty = false;
+    }
+
+    if (m_vertices.empty()) {
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+
+    glUseProgram(m_shaderProgram.id());
+
+    for (int i=0; i<m_shaderProgram.attributeCount(); ++i) {
+        glEnableVertexAttribArray(i);
+    }
+
+    glUniformMatrix4fv(m_shaderProgram.matrix, 1, true, proj.m);
+
+    for (const Batch &batch : m_batches) {
+        if (!batch.indexCount) {
+            continue;
+        }
+        const size_t offset = batch.firstVertex * sizeof(Vertex);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<const void*>(offset + offsetof(Vertex, position)));
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), reinterpret_cast<const void*>(offset + offsetof(Vertex, color)));
+        glDrawElements(GL_TRIANGLES, batch.indexCount, GL_UNSIGNED_SHORT, reinterpret_cast<const void*>(batch.firstIndex * sizeof(uint16_t)));
+    }
+
+    // Not left on for whatever draws next
+    for (int i=1; i<m_shaderProgram.attributeCount(); ++i) {
+        glDisableVertexAttribArray(i);
+    }
+
+    glUseProgram(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,71 @@
+#ifndef POLYGONBATCHNODE_H
+#define POLYGONBATCHNODE_H
+
+#include <rengine.h>
+
+#include <cstdint>
+
+using namespace rengine;
+using namespace std;
+
+// Draws any number of filled polygons, each one a triangle fan around its
+// first point, in scene coordinates. They all go into one vertex buffer that
+// is orphaned and refilled when something changed, and are drawn as indexed
+// triangles with one draw call per 65536 vertices, so the buffer uploads and
+// draw calls don't grow with the number of players.
+class PolygonBatchNode : public RenderNode
+{
+public:
+    PolygonBatchNode();
+    ~PolygonBatchNode();
+
+    void render(const mat4 &proj) override;
+
+    // Returns the id of the new polygon, drawn after the ones before it
+    int addPolygon(const vec4 &color);
+
+    void setPoints(const int polygon, const vector<vec2> &points);
+    void setColor(const int polygon, const vec4 &color);
+    void setVisible(const int polygon, const bool visible);
+
+private:
+    struct Vertex {
+        vec2 position;
+        // Premultiplied
+        uint8_t color[4];
+    };
+
+    struct Polygon {
+        vector<vec2> points;
+        uint8_t color[4];
+        bool visible = true;
+    };
+
+    // What fits in one draw with 16 bit indices
+    struct Batch {
+        size_t firstVertex = 0;
+        size_t firstIndex = 0;
+        size_t indexCount = 0;
+    };
+
+    void upload();
+
+    struct : public OpenGLShaderProgram {
+        int matrix;
+    } m_shaderProgram;
+
+    GLuint m_vertexBuffer;
+    GLuint m_indexBuffer;
+    size_t m_vertexCapacity = 0;
+    size_t m_indexCapacity = 0;
+
+    vector<Polygon> m_polygons;
+    bool m_dirty = false;
+
+    // Kept between uploads so they don't allocate every frame
+    vector<Vertex> m_vertices;
+    vector<uint16_t> m_indices;
+    vector<Batch> m_batches;
+};
+
+#endif // POLYGONBATCHNODE_H
@@ -0,0 +1,116 @@
+#include "profiler.h"
+
+#include "world.h"
+
+void Histogram::record(const uint64_t nanoseconds)
+{
+    // Relaxed is enough, readers only need each value to be whole
+    m_buckets[bucketIndex(nanoseconds)].fetch_add(1, memory_order_relaxed);
+    m_count.fetch_add(1, memory_order_relaxed);
+    m_sum.fetch_add(nanoseconds, memory_order_relaxed);
+
+    uint64_t previousMax = m_max.load(memory_order_relaxed);
+    while (nanoseconds > previousMax && !m_max.compare_exchange_weak(previousMax, nanoseconds, memory_order_relaxed)) {
+    }
+}
+
+double Histogram::mean() const
+{
+    const uint64_t total = count();
+    return total ? double(m_sum.load(memory_order_relaxed)) / total : 0;
+}
+
+uint64_t Histogram::percentile(const double percentile) const
+{
+    const uint64_t total = count();
+    if (!total) {
+        return 0;
+    }
+
+    const uint64_t rank = std::max<uint64_t>(1, uint64_t(percentile / 100 * total + 0.5));
+    uint64_t seen = 0;
+    for (int i=0; i<bucketCount; i++) {
+        seen += m_buckets[i].load(memory_order_relaxed);
+        if (seen >= rank) {
+            return min(bucketLimit(i), max());
+        }
+    }
+    return max();
+}
+
+int Histogram::bucketIndex(const uint64_t value)
+{
+    if (value < linearBuckets) {
+        return value;
+    }
+
+    int exponent = 5;
+    while (exponent < 63 && value >> (exponent + 1)) {
+        exponent++;
+    }
+    const int subBucket = (value >> (exponent - 4)) & (subBuckets - 1);
+    return linearBuckets + (exponent - 5) * subBuckets + subBucket;
+}
+
+uint64_t Histogram::bucketLimit(const int index)
+{
+    if (index < linearBuckets) {
+        return index;
+    }
+
+    const int exponent = (index - linearBuckets) / subBuckets + 5;
+    const uint64_t subBucket = (index - linearBuckets) % subBuckets;
+    return ((subBuckets + subBucket + 1) << (exponent - 4)) - 1;
+}
+
+const char *Profiler::phaseName(const Phase phase)
+{
+    switch(phase) {
+    case Tick:
+        return "tick";
+    case Commands:
+        return "commands";
+    case Bullets:
+        return "bullets";
+    case Visibility:
+        return "visibility";
+    case Serialization:
+        return "serialization";
+    case Writes:
+        return "writes";
+    case Scene:
+        return "scene";
+    case PhaseCount:
+        break;
+    }
+    return "unknown";
+}
+
+void Profiler::record(const Phase phase, const chrono::steady_clock::duration &duration)
+{
+    m_histograms[phase].record(chrono::duration_cast<chrono::nanoseconds>(duration).count());
+
+    if (phase == Tick && duration > World::tickInterval) {
+        addOverrun();
+    }
+}
+
+string Profiler::toJson() const
+{
+    string json = "{";
+    for (int i=0; i<PhaseCount; i++) {
+        const Histogram &histogram = m_histograms[i];
+        if (!histogram.count()) {
+            continue;
+        }
+        json += "\"" + string(phaseName(Phase(i))) + "\":{";
+        json += "\"count\":" + to_string(histogram.count());
+        json += ",\"mean\":" + to_string(histogram.mean() / 1000);
+        json += ",\"p50\":" + to_string(histogram.percentile(50) / 1000.);
+        json += ",\"p99\":" + to_string(histogram.percentile(99) / 1000.);
+        json += ",\"max\":" + to_string(histogram.max() / 1000.);
+        json += "},";
+    }
+    json += "\"overruns\":" + to_string(overruns()) + "}";
+    return json;
+}
@@ -0,0 +1,98 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Latency histogram with buckets that are about 6% wide at any magnitude,
+// like HdrHistogram. Recording and reading never lock, from any thread, the
+// counts are just not a consistent snapshot while something is recording.
+class Histogram
+{
+public:
+    void record(const uint64_t nanoseconds);
+
+    uint64_t count() const { return m_count.load(memory_order_relaxed); }
+    uint64_t max() const { return m_max.load(memory_order_relaxed); }
+    double mean() const;
+
+    // Upper bound of the bucket the percentile (0-100) falls in
+    uint64_t percentile(const double percentile) const;
+
+private:
+    // Values below this are exact, above it 16 buckets per power of two
+    static constexpr int linearBuckets = 32;
+    static constexpr int subBuckets = 16;
+    static constexpr int bucketCount = linearBuckets + (64 - 5) * subBuckets;
+
+    static int bucketIndex(const uint64_t value);
+    static uint64_t bucketLimit(const int index);
+
+    array<atomic<uint32_t>, bucketCount> m_buckets = {};
+    atomic<uint64_t> m_count { 0 };
+    atomic<uint64_t> m_sum { 0 };
+    atomic<uint64_t> m_max { 0 };
+};
+
+// Where a World spends its ticks. Each world is only ticked by one thread at
+// a time, so its profiler is that thread's buffer and recording never locks.
+class Profiler
+{
+public:
+    enum Phase {
+        Tick,
+        Commands,
+        Bullets,
+        Visibility,
+        Serialization,
+        Writes,
+        Scene, // only the viewer
+        PhaseCount
+    };
+
+    static const char *phaseName(const Phase phase);
+
+    void record(const Phase phase, const chrono::steady_clock::duration &duration);
+    const Histogram &histogram(const Phase phase) const { return m_histograms[phase]; }
+
+    // Ticks that took longer than World::tickInterval
+    void addOverrun() { m_overruns.fetch_add(1, memory_order_relaxed); }
+    uint64_t overruns() const { return m_overruns.load(memory_order_relaxed); }
+
+    // One line, {"tick":{"count":..,"mean":..,"p50":..,"p99":..,"max":..},...,"overruns":..},
+    // times in microseconds
+    string toJson() const;
+
+private:
+    array<Histogram, PhaseCount> m_histograms;
+    atomic<uint64_t> m_overruns { 0 };
+};
+
+class ScopedTimer
+{
+public:
+    ScopedTimer(Profiler *profiler, const Profiler::Phase phase) :
+        m_profiler(profiler),
+        m_phase(phase),
+        m_start(chrono::steady_clock::now())
+    {}
+
+    ~ScopedTimer() {
+        m_profiler->record(m_phase, chrono::steady_clock::now() - m_start);
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    Profiler *m_profiler;
+    Profiler::Phase m_phase;
+    chrono::steady_clock::time_point m_start;
+};
+
+#endif // PROFILER_H
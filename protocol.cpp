@@ -0,0 +1,104 @@
+#include "protocol.h"
+
+#include "player.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+namespace protocol {
+
+int16_t quantizePosition(const float value)
+{
+    return int16_t(clamp(lround(value * 4), -32768l, 32767l));
+}
+
+int16_t quantizeRotation(const float value)
+{
+    return int16_t(clamp(lround(value * 10000), -32768l, 32767l));
+}
+
+static void appendNumber(string *out, const float value)
+{
+    char buffer[32];
+    const to_chars_result result = to_chars(buffer, buffer + sizeof(buffer), value);
+    out->append(buffer, result.ptr);
+}
+
+static void appendNumber(string *out, const int value)
+{
+    char buffer[16];
+    const to_chars_result result = to_chars(buffer, buffer + sizeof(buffer), value);
+    out->append(buffer, result.ptr);
+}
+
+void writePlayer(Writer *writer, const Player &player)
+{
+    writer->i32(player.id);
+    writer->f32(player.position().x);
+    writer->f32(player.position().y);
+    writer->f32(player.cursorPosition().x);
+    writer->f32(player.cursorPosition().y);
+    writer->f32(player.rotation());
+    writer->u8(player.isAlive());
+
+    writer->u16(player.bullets().size());
+    player.forEachBullet([writer](const Bullet &bullet) {
+        writeBullet(writer, bullet);
+    });
+}
+
+void writeBullet(Writer *writer, const Bullet &bullet)
+{
+    writer->i32(bullet.id);
+    writer->f32(bullet.position().x);
+    writer->f32(bullet.position().y);
+    writer->f32(bullet.target().x);
+    writer->f32(bullet.target().y);
+}
+
+void writeJson(string *out, const Player &player)
+{
+    // Same key order as SimpleJSON gives
+    out->append("{\"alive\":");
+    out->append(player.isAlive() ? "true" : "false");
+    out->append(",\"bullets\":[");
+    bool first = true;
+    player.forEachBullet([&](const Bullet &bullet) {
+        if (!first) {
+            out->push_back(',');
+        }
+        first = false;
+        writeJson(out, bullet);
+    });
+    out->append("],\"id\":");
+    appendNumber(out, player.id);
+    out->append(",\"pointing_at_x\":");
+    appendNumber(out, player.cursorPosition().x);
+    out->append(",\"pointing_at_y\":");
+    appendNumber(out, player.cursorPosition().y);
+    out->append(",\"rotation\":");
+    appendNumber(out, player.rotation());
+    out->append(",\"x\":");
+    appendNumber(out, player.position().x);
+    out->append(",\"y\":");
+    appendNumber(out, player.position().y);
+    out->push_back('}');
+}
+
+void writeJson(string *out, const Bullet &bullet)
+{
+    out->append("{\"id\":");
+    appendNumber(out, bullet.id);
+    out->append(",\"target_x\":");
+    appendNumber(out, bullet.target().x);
+    out->append(",\"target_y\":");
+    appendNumber(out, bullet.target().y);
+    out->append(",\"x\":");
+    appendNumber(out, bullet.position().x);
+    out->append(",\"y\":");
+    appendNumber(out, bullet.position().y);
+    out->push_back('}');
+}
+
+}
@@ -0,0 +1,260 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Player;
+class Bullet;
+
+// Binary framing, selected by a bot sending "PROTOCOL BINARY". Everything is
+// little-endian, floats are IEEE 754 single precision.
+//
+// Frame:
+//   u32 length     bytes following this field
+//   u8  type       FrameUpdate
+//   u32 tick
+//   u32 seed       of the world, the same for the whole game
+//   player         you
+//   u16 count      other players
+//   player[count]
+//
+// Player record:
+//   i32 id, f32 x, f32 y, f32 pointing_at_x, f32 pointing_at_y,
+//   f32 rotation, u8 alive, u16 bullet count, bullet[bullet count]
+//
+// Bullet record:
+//   i32 id, f32 x, f32 y, f32 target_x, f32 target_y
+//
+// "PROTOCOL DELTA" uses the same framing, but only sends what changed since
+// the last tick the bot acknowledged with "ACK <tick>". The bot has to keep
+// the states it has acknowledged around, since the delta is against the one
+// given as the base tick. A keyframe with everything is sent when there is
+// nothing usable to delta against, every keyframeInterval ticks, and when the
+// bot asks for it with "KEYFRAME".
+//
+// Positions are i16 in quarter pixels, so -8192 to 8191.75, rotation is i16
+// in 1/10000 radians. Worlds are at most maxCoordinate in either direction,
+// so anything on the map fits. Cursor positions and bullet targets are where
+// the bot asked for, and are clamped to that range.
+//
+// All the counts are u16, there are never more than maxBullets bullets in a
+// world, a FIRE when it is full does nothing.
+//
+// Keyframe:
+//   u32 length, u8 type (FrameKeyframe), u32 tick, u32 seed, i32 your id,
+//   u16 count, player[count], u16 count, bullet[count]
+//   player: i32 id, u8 alive, i16 x, i16 y, i16 pointing_at_x,
+//           i16 pointing_at_y, i16 rotation
+//   bullet: i32 id, i32 owner, i16 x, i16 y, i16 target_x, i16 target_y
+//
+// Delta:
+//   u32 length, u8 type (FrameDelta), u32 tick, u32 base tick, i32 your id,
+//   u16 count, i32 removed player id[count],
+//   u16 count, changed player[count],
+//   u16 count, i32 removed bullet id[count],
+//   u16 count, changed bullet[count]
+//   changed player: i32 id, u8 mask, then the fields in the keyframe order
+//                   that have their bit set (PlayerField)
+//   changed bullet: i32 id, u8 mask, fields as above (BulletField)
+//   New players and bullets have all bits set.
+//
+// "STATS" is answered right away with the world's tick profile as JSON, a
+// line like {"type":"stats","tick":{"count":..,"p50":..,...},...} with the
+// text protocol. Binary and delta connections get it framed instead:
+//   u32 length, u8 type (FrameStats), the JSON without the newline
+// A STATS that comes while the last answer is still being written is
+// ignored.
+namespace protocol {
+
+enum Protocol {
+    Text,
+    Binary,
+    Delta
+};
+
+enum FrameType {
+    FrameUpdate = 1,
+    FrameKeyframe = 2,
+    FrameDelta = 3,
+    FrameStats = 4
+};
+
+enum PlayerField {
+    PlayerAlive = 1 << 0,
+    PlayerX = 1 << 1,
+    PlayerY = 1 << 2,
+    PlayerPointingX = 1 << 3,
+    PlayerPointingY = 1 << 4,
+    PlayerRotation = 1 << 5,
+    PlayerAll = (1 << 6) - 1
+};
+
+enum BulletField {
+    BulletOwner = 1 << 0,
+    BulletX = 1 << 1,
+    BulletY = 1 << 2,
+    BulletTargetX = 1 << 3,
+    BulletTargetY = 1 << 4,
+    BulletAll = (1 << 5) - 1
+};
+
+// One second
+static constexpr uint32_t keyframeInterval = 50;
+
+// Part of an encoded message, written out without being copied together
+struct Slice {
+    const char *data;
+    size_t size;
+};
+
+// Largest position the quarter pixel i16 fields can hold
+static constexpr float maxCoordinate = 8191.f;
+
+// Most bullets there can be in a world at once, so the u16 bullet counts in
+// the frames and replays can't wrap
+static constexpr size_t maxBullets = UINT16_MAX;
+
+int16_t quantizePosition(const float value);
+int16_t quantizeRotation(const float value);
+
+class Writer
+{
+public:
+    Writer(vector<char> *buffer) : m_buffer(buffer) {}
+
+    void u8(const uint8_t value) { m_buffer->push_back(char(value)); }
+    void u16(const uint16_t value) {
+        u8(value & 0xff);
+        u8(value >> 8);
+    }
+    void u32(const uint32_t value) {
+        u16(value & 0xffff);
+        u16(value >> 16);
+    }
+    void u64(const uint64_t value) {
+        u32(value & 0xffffffff);
+        u32(value >> 32);
+    }
+    void i16(const int16_t value) { u16(uint16_t(value)); }
+    void i32(const int32_t value) { u32(uint32_t(value)); }
+    void f32(const float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        u32(bits);
+    }
+
+    // Reserves room for a u32 length and fills it in when the frame is done
+    size_t beginFrame() {
+        const size_t position = m_buffer->size();
+        u32(0);
+        return position;
+    }
+    // For counts that are only known after the items are written
+    void setU16(const size_t position, const uint16_t value) {
+        (*m_buffer)[position] = char(value & 0xff);
+        (*m_buffer)[position + 1] = char(value >> 8);
+    }
+    void setU32(const size_t position, const uint32_t value) {
+        setU16(position, value & 0xffff);
+        setU16(position + 2, value >> 16);
+    }
+    size_t position() const { return m_buffer->size(); }
+
+    void endFrame(const size_t position) {
+        setU32(position, m_buffer->size() - position - 4);
+    }
+
+private:
+    vector<char> *m_buffer;
+};
+
+// Reads what Writer wrote, running past the end gives zeroes and clears ok()
+class Reader
+{
+public:
+    Reader(const char *data, const size_t size) : m_data(data), m_size(size) {}
+
+    uint8_t u8() {
+        if (m_position + 1 > m_size) {
+            m_ok = false;
+            return 0;
+        }
+        return uint8_t(m_data[m_position++]);
+    }
+    uint16_t u16() {
+        const uint16_t low = u8();
+        return low | uint16_t(u8()) << 8;
+    }
+    uint32_t u32() {
+        const uint32_t low = u16();
+        return low | uint32_t(u16()) << 16;
+    }
+    uint64_t u64() {
+        const uint64_t low = u32();
+        return low | uint64_t(u32()) << 32;
+    }
+    int16_t i16() { return int16_t(u16()); }
+    int32_t i32() { return int32_t(u32()); }
+    float f32() {
+        const uint32_t bits = u32();
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+    // Points into the data, size bytes long
+    const char *bytes(const size_t size) {
+        if (m_position + size > m_size) {
+            m_ok = false;
+            return nullptr;
+        }
+        const char *bytes = m_data + m_position;
+        m_position += size;
+        return bytes;
+    }
+
+    // For a count read from the data, before anything is allocated for it.
+    // False, and clears ok(), if there aren't count items of at least
+    // itemSize bytes left.
+    bool fits(const size_t count, const size_t itemSize) {
+        const size_t left = m_position < m_size ? m_size - m_position : 0;
+        if (count > left / itemSize) {
+            m_ok = false;
+            return false;
+        }
+        return true;
+    }
+
+    // For something read that can't be right, the rest is then treated as
+    // if the data was cut short
+    void fail() { m_ok = false; }
+
+    bool ok() const { return m_ok; }
+    bool atEnd() const { return m_position >= m_size; }
+    size_t position() const { return m_position; }
+    void seek(const size_t position) {
+        m_position = position;
+        m_ok = position <= m_size;
+    }
+
+private:
+    const char *m_data;
+    size_t m_size;
+    size_t m_position = 0;
+    bool m_ok = true;
+};
+
+void writePlayer(Writer *writer, const Player &player);
+void writeBullet(Writer *writer, const Bullet &bullet);
+
+// Compact JSON for the text protocol, same fields as Player::serializeState()
+void writeJson(string *out, const Player &player);
+void writeJson(string *out, const Bullet &bullet);
+
+}
+
+#endif // PROTOCOL_H
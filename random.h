@@ -0,0 +1,67 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include <limits>
+#include <random>
+
+using namespace std;
+
+// PCG32 (pcg-random.org). Small, fast and good enough for maps and spawn
+// points, and unlike rand() every match has its own, so matches on different
+// threads neither contend nor change each other's games.
+class Random
+{
+public:
+    typedef uint32_t result_type;
+
+    explicit Random(const uint64_t seed = 0) { setSeed(seed); }
+
+    void setSeed(const uint64_t seed) {
+        m_state = 0;
+        next();
+        m_state += seed;
+        next();
+    }
+
+    uint32_t operator()() { return next(); }
+
+    // Uniform in [0, bound), without the bias of next() % bound
+    uint32_t bounded(const uint32_t bound) {
+        if (bound == 0) {
+            return 0;
+        }
+        const uint32_t threshold = -bound % bound;
+        uint32_t value;
+        do {
+            value = next();
+        } while (value < threshold);
+        return value % bound;
+    }
+
+    // Uniform in [0, 1)
+    float uniform() { return (next() >> 8) * (1.f / (1 << 24)); }
+
+    // All of it, for replays
+    uint64_t state() const { return m_state; }
+    void setState(const uint64_t state) { m_state = state; }
+
+    static constexpr uint32_t min() { return 0; }
+    static constexpr uint32_t max() { return numeric_limits<uint32_t>::max(); }
+
+    // For when no seed is given
+    static uint32_t randomSeed() { return random_device()(); }
+
+private:
+    uint32_t next() {
+        const uint64_t state = m_state;
+        m_state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        const uint32_t xorShifted = uint32_t(((state >> 18) ^ state) >> 27);
+        const uint32_t rotation = uint32_t(state >> 59);
+        return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+    }
+
+    uint64_t m_state;
+};
+
+#endif // RANDOM_H
@@ -0,0 +1,513 @@
+#include "reactor.h"
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Enough for everything a bot sends in a tick many times over, so one read
+// per event is the norm
+static constexpr size_t readBufferSize = 64 * 1024;
+
+// An update is a handful of slices, this is plenty for one sendmsg()
+static constexpr int maxIovecs = 16;
+
+// What the events point at, a listener or a connection
+struct EpollSource
+{
+    bool isListener = false;
+};
+
+struct EpollListener : public EpollSource
+{
+    int fd = -1;
+    Reactor::AcceptHandler onAccept;
+};
+
+class EpollConnection : public EpollSource, public Connection
+{
+public:
+    EpollConnection(const int fd) : m_fd(fd), m_connected(true) {}
+    ~EpollConnection();
+
+    void setHandlers(DataHandler onData, ClosedHandler onClosed) override;
+    bool write(vector<char> &&buffer, function<void()> done) override;
+    bool write(const vector<protocol::Slice> &slices, shared_ptr<const void> owner, function<void()> done) override;
+    bool isConnected() const override { return m_connected; }
+    void close() override;
+
+    int fd() const { return m_fd; }
+
+    // The rest is only called from the connection's loop
+    void deliver(const char *data, const size_t size);
+    void flush();
+    void onClosed();
+
+private:
+    // What is left of a write, from offset into the first slice
+    struct PendingWrite {
+        vector<protocol::Slice> slices;
+        size_t slice = 0;
+        size_t offset = 0;
+        shared_ptr<const void> owner;
+        function<void()> done;
+    };
+
+    // Writes as much as the socket takes with one sendmsg() per maxIovecs
+    // slices, and moves slice and offset past it. False if the socket is
+    // full, true when it is all written or the socket failed.
+    bool send(const protocol::Slice *slices, const size_t count, size_t *slice, size_t *offset);
+
+    // Held while a handler runs, so close() waits for it
+    recursive_mutex m_handlerMutex;
+    DataHandler m_onData;
+    ClosedHandler m_onClosed;
+    string m_unread;
+    bool m_closed = false;
+
+    // Guards the socket too, so it is not closed in the middle of a send
+    mutex m_writeMutex;
+    int m_fd;
+    deque<PendingWrite> m_pendingWrites;
+
+    atomic<bool> m_connected;
+};
+
+EpollConnection::~EpollConnection()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void EpollConnection::setHandlers(DataHandler onData, ClosedHandler onClosed)
+{
+    lock_guard<recursive_mutex> lock(m_handlerMutex);
+    if (m_closed) {
+        return;
+    }
+    m_onData = move(onData);
+    m_onClosed = move(onClosed);
+
+    if (m_onData && !m_unread.empty()) {
+        const string unread = move(m_unread);
+        m_unread.clear();
+        const DataHandler handler = m_onData;
+        handler(unread.data(), unread.size());
+    }
+}
+
+bool EpollConnection::write(vector<char> &&buffer, function<void()> done)
+{
+    const shared_ptr<vector<char>> owner = make_shared<vector<char>>(move(buffer));
+    return write({ { owner->data(), owner->size() } }, owner, move(done));
+}
+
+bool EpollConnection::write(const vector<protocol::Slice> &slices, shared_ptr<const void> owner, function<void()> done)
+{
+    lock_guard<mutex> lock(m_writeMutex);
+    if (m_fd < 0) {
+        return true;
+    }
+
+    size_t slice = 0;
+    size_t offset = 0;
+    if (m_pendingWrites.empty() && send(slices.data(), slices.size(), &slice, &offset)) {
+        return true;
+    }
+
+    // Full, EPOLLOUT tells the loop when there is room again
+    PendingWrite pending;
+    pending.slices.assign(slices.begin() + slice, slices.end());
+    pending.offset = offset;
+    pending.owner = move(owner);
+    pending.done = move(done);
+    m_pendingWrites.push_back(move(pending));
+    return false;
+}
+
+bool EpollConnection::send(const protocol::Slice *slices, const size_t count, size_t *slice, size_t *offset)
+{
+    while (true) {
+        while (*slice < count && *offset >= slices[*slice].size) {
+            (*slice)++;
+            *offset = 0;
+        }
+        if (*slice >= count) {
+            return true;
+        }
+
+        iovec vectors[maxIovecs];
+        int vectorCount = 0;
+        for (size_t i=*slice; i<count && vectorCount<maxIovecs; i++) {
+            const size_t skip = i == *slice ? *offset : 0;
+            vectors[vectorCount].iov_base = const_cast<char*>(slices[i].data + skip);
+            vectors[vectorCount].iov_len = slices[i].size - skip;
+            vectorCount++;
+        }
+
+        // writev() with MSG_NOSIGNAL, so a closed socket doesn't kill us
+        msghdr message = {};
+        message.msg_iov = vectors;
+        message.msg_iovlen = vectorCount;
+        const ssize_t written = ::sendmsg(m_fd, &message, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Anything but a full socket, and the loop sees it too and closes it
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        }
+
+        size_t left = written;
+        while (left > 0) {
+            const size_t remaining = slices[*slice].size - *offset;
+            if (left < remaining) {
+                *offset += left;
+                break;
+            }
+            left -= remaining;
+            (*slice)++;
+            *offset = 0;
+        }
+    }
+}
+
+void EpollConnection::close()
+{
+    {
+        lock_guard<recursive_mutex> lock(m_handlerMutex);
+        m_onData = nullptr;
+        m_onClosed = nullptr;
+        m_closed = true;
+    }
+
+    lock_guard<mutex> lock(m_writeMutex);
+    m_pendingWrites.clear();
+    m_connected = false;
+    if (m_fd >= 0) {
+        // The loop gets a hangup and cleans up from there
+        shutdown(m_fd, SHUT_RDWR);
+    }
+}
+
+void EpollConnection::deliver(const char *data, const size_t size)
+{
+    lock_guard<recursive_mutex> lock(m_handlerMutex);
+    if (!m_onData) {
+        if (!m_closed) {
+            m_unread.append(data, size);
+        }
+        return;
+    }
+
+    // A copy, the handler may replace itself
+    const DataHandler handler = m_onData;
+    handler(data, size);
+}
+
+void EpollConnection::flush()
+{
+    // The owners are let go only after done has been called
+    vector<PendingWrite> finished;
+    {
+        lock_guard<mutex> lock(m_writeMutex);
+        while (m_fd >= 0 && !m_pendingWrites.empty()) {
+            PendingWrite &pending = m_pendingWrites.front();
+            if (!send(pending.slices.data(), pending.slices.size(), &pending.slice, &pending.offset)) {
+                break;
+            }
+            finished.push_back(move(pending));
+            m_pendingWrites.pop_front();
+        }
+    }
+
+    if (finished.empty()) {
+        return;
+    }
+
+    lock_guard<recursive_mutex> lock(m_handlerMutex);
+    if (m_closed) {
+        return;
+    }
+    for (const PendingWrite &pending : finished) {
+        if (pending.done) {
+            pending.done();
+        }
+    }
+}
+
+void EpollConnection::onClosed()
+{
+    {
+        lock_guard<mutex> lock(m_writeMutex);
+        m_pendingWrites.clear();
+        m_connected = false;
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    lock_guard<recursive_mutex> lock(m_handlerMutex);
+    const ClosedHandler handler = m_onClosed;
+    m_onData = nullptr;
+    m_onClosed = nullptr;
+    m_unread.clear();
+    m_closed = true;
+    if (handler) {
+        handler();
+    }
+}
+
+Reactor::Reactor(const int threadCount) :
+    m_quit(false)
+{
+    for (int i=0; i<max(1, threadCount); i++) {
+        unique_ptr<Loop> loop = make_unique<Loop>();
+        loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+        loop->wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loop->readBuffer.resize(readBufferSize);
+
+        // No source, so the loop knows to check m_quit
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->wakeup, &event);
+
+        m_loops.push_back(move(loop));
+    }
+
+    for (const unique_ptr<Loop> &loop : m_loops) {
+        loop->worker = thread(&Reactor::run, this, loop.get());
+    }
+}
+
+Reactor::~Reactor()
+{
+    m_quit = true;
+    for (const unique_ptr<Loop> &loop : m_loops) {
+        const uint64_t one = 1;
+        if (::write(loop->wakeup, &one, sizeof(one)) < 0) {
+            cerr << "Failed to wake up network thread: " << strerror(errno) << endl;
+        }
+    }
+    for (const unique_ptr<Loop> &loop : m_loops) {
+        loop->worker.join();
+        ::close(loop->wakeup);
+        ::close(loop->epoll);
+    }
+
+    for (const unique_ptr<EpollListener> &listener : m_listeners) {
+        ::close(listener->fd);
+    }
+
+    // Players might still hold on to them, but nothing reads them anymore
+    for (const pair<EpollConnection* const, shared_ptr<EpollConnection>> &connection : m_connections) {
+        connection.second->onClosed();
+    }
+}
+
+bool Reactor::listen(const string &host, const int port, AcceptHandler onAccept)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    addrinfo *addresses = nullptr;
+    const int error = getaddrinfo(host.c_str(), to_string(port).c_str(), &hints, &addresses);
+    if (error != 0) {
+        m_errorString = host + ": " + gai_strerror(error);
+        return false;
+    }
+
+    // IPv4 first, "localhost" should work for bots connecting to 127.0.0.1
+    vector<addrinfo*> candidates;
+    for (addrinfo *address = addresses; address; address = address->ai_next) {
+        if (address->ai_family == AF_INET) {
+            candidates.insert(candidates.begin(), address);
+        } else {
+            candidates.push_back(address);
+        }
+    }
+
+    int fd = -1;
+    for (addrinfo *address : candidates) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0) {
+            m_errorString = strerror(errno);
+            continue;
+        }
+
+        const int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+        if (bind(fd, address->ai_addr, address->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0) {
+            break;
+        }
+        m_errorString = "port " + to_string(port) + ": " + strerror(errno);
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    unique_ptr<EpollListener> listener = make_unique<EpollListener>();
+    listener->isListener = true;
+    listener->fd = fd;
+    listener->onAccept = move(onAccept);
+
+    // The first loop accepts, the connections are spread over all of them
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = static_cast<EpollSource*>(listener.get());
+    if (epoll_ctl(m_loops[0]->epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+        m_errorString = strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    m_listeners.push_back(move(listener));
+    return true;
+}
+
+void Reactor::run(Loop *loop)
+{
+    epoll_event events[64];
+    while (!m_quit) {
+        const int count = epoll_wait(loop->epoll, events, 64, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            cerr << "epoll_wait failed: " << strerror(errno) << endl;
+            return;
+        }
+
+        for (int i=0; i<count; i++) {
+            EpollSource *source = static_cast<EpollSource*>(events[i].data.ptr);
+            if (!source) {
+                continue;
+            }
+            if (source->isListener) {
+                accept(static_cast<EpollListener*>(source));
+            } else {
+                onEvents(loop, static_cast<EpollConnection*>(source), events[i].events);
+            }
+        }
+    }
+}
+
+void Reactor::accept(EpollListener *listener)
+{
+    // Edge-triggered, so everyone waiting has to be taken now
+    while (true) {
+        const int fd = accept4(listener->fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                cerr << "Failed to accept: " << strerror(errno) << endl;
+            }
+            return;
+        }
+
+        // Updates are small and late is as good as lost
+        const int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        const shared_ptr<EpollConnection> connection = make_shared<EpollConnection>(fd);
+        Loop *loop = m_loops[m_nextLoop++ % m_loops.size()].get();
+        {
+            lock_guard<mutex> lock(m_connectionsMutex);
+            m_connections[connection.get()] = connection;
+        }
+
+        // Whatever arrives before the handlers are set is kept for them
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = static_cast<EpollSource*>(connection.get());
+        if (epoll_ctl(loop->epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+            cerr << "Failed to add connection: " << strerror(errno) << endl;
+            lock_guard<mutex> lock(m_connectionsMutex);
+            m_connections.erase(connection.get());
+            continue;
+        }
+
+        if (!listener->onAccept(connection)) {
+            connection->close();
+        }
+    }
+}
+
+void Reactor::onEvents(Loop *loop, EpollConnection *connection, const uint32_t events)
+{
+    if (events & EPOLLOUT) {
+        connection->flush();
+    }
+
+    bool closed = events & (EPOLLHUP | EPOLLERR);
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        while (true) {
+            const ssize_t size = recv(connection->fd(), loop->readBuffer.data(), loop->readBuffer.size(), 0);
+            if (size > 0) {
+                connection->deliver(loop->readBuffer.data(), size);
+
+                // Less than asked for means it is empty, anything arriving
+                // after this is a new edge
+                if (size_t(size) < loop->readBuffer.size() && !(events & EPOLLRDHUP)) {
+                    break;
+                }
+                continue;
+            }
+            if (size < 0 && errno == EINTR) {
+                continue;
+            }
+            if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            closed = true;
+            break;
+        }
+    }
+
+    if (closed) {
+        remove(loop, connection);
+    }
+}
+
+void Reactor::remove(Loop *loop, EpollConnection *connection)
+{
+    epoll_ctl(loop->epoll, EPOLL_CTL_DEL, connection->fd(), nullptr);
+
+    shared_ptr<EpollConnection> keepAlive;
+    {
+        lock_guard<mutex> lock(m_connectionsMutex);
+        const unordered_map<EpollConnection*, shared_ptr<EpollConnection>>::iterator it = m_connections.find(connection);
+        if (it == m_connections.end()) {
+            return;
+        }
+        keepAlive = move(it->second);
+        m_connections.erase(it);
+    }
+
+    keepAlive->onClosed();
+}
+
+#endif // __linux__
@@ -0,0 +1,68 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#ifdef __linux__
+
+#include "connection.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+class EpollConnection;
+struct EpollListener;
+
+// Edge-triggered epoll loop for the server's sockets, instead of tacopie's
+// poll loop and callback workers. Every connection belongs to one of the
+// loop threads, which reads everything there is into one big buffer and hands
+// it straight to the connection's data handler, so commands are parsed and
+// queued without another thread in between. Writes go out right away from the
+// thread that writes, and only wait for the loop when the socket is full.
+class Reactor
+{
+public:
+    // Return false to have the connection closed
+    typedef function<bool(const shared_ptr<Connection> &connection)> AcceptHandler;
+
+    Reactor(const int threadCount = 1);
+    ~Reactor();
+
+    bool listen(const string &host, const int port, AcceptHandler onAccept);
+    const string &errorString() const { return m_errorString; }
+
+    int threadCount() const { return m_loops.size(); }
+
+private:
+    struct Loop {
+        int epoll = -1;
+        int wakeup = -1;
+        thread worker;
+        vector<char> readBuffer;
+    };
+
+    void run(Loop *loop);
+    void accept(EpollListener *listener);
+    void onEvents(Loop *loop, EpollConnection *connection, const uint32_t events);
+    void remove(Loop *loop, EpollConnection *connection);
+
+    vector<unique_ptr<Loop>> m_loops;
+    atomic<bool> m_quit;
+    size_t m_nextLoop = 0;
+
+    mutex m_connectionsMutex;
+    unordered_map<EpollConnection*, shared_ptr<EpollConnection>> m_connections;
+    vector<unique_ptr<EpollListener>> m_listeners;
+
+    string m_errorString;
+};
+
+#endif // __linux__
+
+#endif // REACTOR_H
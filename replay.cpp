@@ -0,0 +1,657 @@
+#include "replay.h"
+
+#include "player.h"
+#include "world.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+extern "C" {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+#endif
+
+static constexpr char s_headerMagic[4] = { 'T', 'G', 'R', 'P' };
+static constexpr char s_indexMagic[4] = { 'T', 'G', 'R', 'I' };
+
+// RecordEnd footer after the keyframe entries: u64 offset, magic
+static constexpr size_t s_footerSize = 8 + 4;
+
+// The smallest each counted item can be, to check the counts against
+static constexpr size_t s_rectangleSize = 4 * 4;
+static constexpr size_t s_indexEntrySize = 4 + 8;
+static constexpr size_t s_commandSize = 2 + 1;
+static constexpr size_t s_playerSize = 4 + 1 + 8 + 8 + 4 + 1 + 2;
+static constexpr size_t s_bulletSize = 4 + 8 + 8 + 8 + 8 + 4 + 4 + 1;
+
+static void writeVec2(protocol::Writer *writer, const Vec2 &value)
+{
+    writer->f32(value.x);
+    writer->f32(value.y);
+}
+
+// Nothing the simulation writes is NaN or infinite, and it isn't made to
+// cope with them, so they mean the file is corrupt
+static float readFloat(protocol::Reader *reader)
+{
+    const float value = reader->f32();
+    if (!isfinite(value)) {
+        reader->fail();
+    }
+    return value;
+}
+
+static Vec2 readVec2(protocol::Reader *reader)
+{
+    const float x = readFloat(reader);
+    return Vec2(x, readFloat(reader));
+}
+
+ReplayRecorder::ReplayRecorder(FILE *file, const World &world) :
+    m_file(file)
+{
+    protocol::Writer writer(&m_buffer);
+    m_buffer.insert(m_buffer.end(), s_headerMagic, s_headerMagic + 4);
+    writer.u16(replay::version);
+    writer.u32(world.seed());
+    writeVec2(&writer, world.size());
+    writer.u16(world.commandBudget());
+    writer.u16(replay::keyframeInterval);
+    writer.u16(world.rectangles().size());
+    for (const Rect &rectangle : world.rectangles()) {
+        writeVec2(&writer, rectangle.tl);
+        writeVec2(&writer, rectangle.br);
+    }
+
+    m_firstKeyframeTick = world.tickCount();
+    writeKeyframe(world);
+    flush();
+}
+
+ReplayRecorder::~ReplayRecorder()
+{
+    if (m_finished) {
+        return;
+    }
+
+    // Without the world there is no last tick, but everything before it is there
+    flush();
+    fclose(m_file);
+}
+
+void ReplayRecorder::beginTick(const World &world)
+{
+    // The previous tick is done now
+    if (m_tick >= 0) {
+        writeTick(world);
+        if ((m_tick - m_firstKeyframeTick) % replay::keyframeInterval == 0) {
+            writeKeyframe(world);
+        }
+        flush();
+    }
+
+    m_tick = world.tickCount() + 1;
+    m_commands.clear();
+}
+
+void ReplayRecorder::addCommand(const int playerId, const Command &command)
+{
+    m_commands.push_back({ playerId, command });
+}
+
+void ReplayRecorder::finish(const World &world)
+{
+    if (m_finished) {
+        return;
+    }
+
+    if (m_tick >= 0) {
+        writeTick(world);
+    }
+    if (m_keyframes.empty() || long(m_keyframes.back().first) != world.tickCount()) {
+        writeKeyframe(world);
+    }
+
+    const uint64_t endOffset = m_offset + m_buffer.size();
+    protocol::Writer writer(&m_buffer);
+    writer.u8(replay::RecordEnd);
+    writer.u32(m_keyframes.size());
+    for (const pair<uint32_t, uint64_t> &keyframe : m_keyframes) {
+        writer.u32(keyframe.first);
+        writer.u64(keyframe.second);
+    }
+    writer.u64(endOffset);
+    m_buffer.insert(m_buffer.end(), s_indexMagic, s_indexMagic + 4);
+    flush();
+
+    fclose(m_file);
+    m_finished = true;
+}
+
+void ReplayRecorder::writeTick(const World &world)
+{
+    protocol::Writer writer(&m_buffer);
+    writer.u8(replay::RecordTick);
+    writer.u32(m_tick);
+    writer.u16(world.allPlayers().size());
+    writer.u16(m_commands.size());
+    for (const pair<int, Command> &command : m_commands) {
+        writer.u16(command.first);
+        writer.u8(command.second.type);
+        if (command.second.type == Command::PointAt) {
+            writer.f32(command.second.x);
+            writer.f32(command.second.y);
+        } else if (command.second.type == Command::Name) {
+            const string_view name = command.second.textView();
+            writer.u8(name.size());
+            m_buffer.insert(m_buffer.end(), name.begin(), name.end());
+        }
+    }
+}
+
+void ReplayRecorder::writeKeyframe(const World &world)
+{
+    m_keyframes.push_back({ uint32_t(world.tickCount()), m_offset + m_buffer.size() });
+
+    protocol::Writer writer(&m_buffer);
+    writer.u8(replay::RecordKeyframe);
+    writer.u32(world.tickCount());
+    writer.u64(world.m_random.state());
+    writer.i32(world.m_nextPlayerId);
+    writer.i32(world.m_nextBulletId);
+    writer.u8(world.m_running | world.m_gameOver << 1);
+
+    writer.u16(world.allPlayers().size());
+    for (const shared_ptr<Player> &player : world.allPlayers()) {
+        writer.i32(player->id);
+        writer.u8(player->isAlive());
+        writeVec2(&writer, player->position());
+        writeVec2(&writer, player->cursorPosition());
+        writer.f32(player->rotation());
+        const string name = player->name().substr(0, 255);
+        writer.u8(name.size());
+        m_buffer.insert(m_buffer.end(), name.begin(), name.end());
+
+        writer.u16(player->bullets().size());
+        for (const BulletHandle &handle : player->bullets()) {
+            const BulletStore::State bullet = world.bullets().state(world.bullets().indexOf(handle));
+            writer.i32(bullet.id);
+            writeVec2(&writer, bullet.origin);
+            writeVec2(&writer, bullet.velocity);
+            writeVec2(&writer, bullet.position);
+            writeVec2(&writer, bullet.target);
+            writer.f32(bullet.flightTime);
+            writer.f32(bullet.duration);
+            writer.u8(bullet.startedInside | bullet.flying << 1);
+        }
+    }
+}
+
+void ReplayRecorder::flush()
+{
+    if (m_buffer.empty()) {
+        return;
+    }
+    if (fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size()) {
+        cerr << "Failed to write replay" << endl;
+    }
+    m_offset += m_buffer.size();
+    m_buffer.clear();
+}
+
+struct Replay::MappedFile
+{
+#ifdef _WIN32
+    // Just read in, it is not worth the Windows mapping API
+    vector<char> contents;
+#else
+    void *address = MAP_FAILED;
+    size_t size = 0;
+
+    ~MappedFile() {
+        if (address != MAP_FAILED) {
+            munmap(address, size);
+        }
+    }
+#endif
+};
+
+struct Replay::Keyframe
+{
+    struct Bullet {
+        int id;
+        Vec2 origin;
+        Vec2 velocity;
+        Vec2 position;
+        Vec2 target;
+        float flightTime;
+        float duration;
+        uint8_t flags;
+    };
+
+    struct Player {
+        int id;
+        bool alive;
+        Vec2 position;
+        Vec2 cursorPosition;
+        float rotation;
+        string name;
+        vector<Bullet> bullets;
+    };
+
+    uint32_t tick;
+    uint64_t random;
+    int nextPlayerId;
+    int nextBulletId;
+    uint8_t flags;
+    vector<Player> players;
+};
+
+Replay::Replay()
+{
+}
+
+Replay::~Replay()
+{
+}
+
+bool Replay::open(const string &path)
+{
+    m_file = make_unique<MappedFile>();
+
+#ifdef _WIN32
+    ifstream file(path, ios::binary);
+    if (!file) {
+        m_error = "Unable to open " + path;
+        return false;
+    }
+    m_file->contents.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    m_data = m_file->contents.data();
+    m_dataSize = m_file->contents.size();
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        m_error = "Unable to open " + path;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        m_file->size = info.st_size;
+        m_file->address = mmap(nullptr, m_file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (m_file->address == MAP_FAILED) {
+        m_error = "Unable to map " + path;
+        return false;
+    }
+    m_data = static_cast<const char*>(m_file->address);
+    m_dataSize = m_file->size;
+#endif
+
+    if (!readHeader() || !buildIndex()) {
+        return false;
+    }
+
+    createWorld();
+    return seek(firstTick());
+}
+
+long Replay::firstTick() const
+{
+    return m_keyframes.empty() ? 0 : m_keyframes.front().first;
+}
+
+long Replay::lastTick() const
+{
+    return m_lastTick;
+}
+
+bool Replay::readHeader()
+{
+    protocol::Reader reader(m_data, m_dataSize);
+    const char *magic = reader.bytes(4);
+    if (!magic || memcmp(magic, s_headerMagic, 4) != 0) {
+        m_error = "Not a replay";
+        return false;
+    }
+    if (reader.u16() != replay::version) {
+        m_error = "Unsupported replay version";
+        return false;
+    }
+
+    m_seed = reader.u32();
+    m_size = readVec2(&reader);
+    m_commandBudget = reader.u16();
+    m_keyframeInterval = max<int>(reader.u16(), 1);
+
+    const uint16_t rectangleCount = reader.u16();
+    if (!reader.fits(rectangleCount, s_rectangleSize)) {
+        m_error = "Replay header has more rectangles than the file has room for";
+        return false;
+    }
+    m_rectangles.resize(rectangleCount);
+    for (Rect &rectangle : m_rectangles) {
+        rectangle.tl = readVec2(&reader);
+        rectangle.br = readVec2(&reader);
+    }
+
+    if (!reader.ok()) {
+        m_error = "Truncated or corrupt replay header";
+        return false;
+    }
+
+    m_recordsOffset = reader.position();
+    return true;
+}
+
+bool Replay::buildIndex()
+{
+    m_keyframes.clear();
+    m_lastTick = 0;
+
+    // Finished recording, the index is at the end
+    if (m_dataSize >= m_recordsOffset + s_footerSize &&
+            memcmp(m_data + m_dataSize - 4, s_indexMagic, 4) == 0) {
+        protocol::Reader reader(m_data, m_dataSize);
+        reader.seek(m_dataSize - s_footerSize);
+        reader.seek(reader.u64());
+        const uint8_t type = reader.u8();
+        const uint32_t keyframeCount = reader.u32();
+        if (type == replay::RecordEnd && reader.fits(keyframeCount, s_indexEntrySize)) {
+            m_keyframes.resize(keyframeCount);
+            for (pair<uint32_t, uint64_t> &keyframe : m_keyframes) {
+                keyframe.first = reader.u32();
+                keyframe.second = reader.u64();
+            }
+            if (reader.ok() && !m_keyframes.empty()) {
+                // The last keyframe is written after the last tick
+                m_lastTick = m_keyframes.back().first;
+                return true;
+            }
+        }
+        m_keyframes.clear();
+    }
+
+    // Cut short, go through the records
+    protocol::Reader reader(m_data, m_dataSize);
+    reader.seek(m_recordsOffset);
+    uint32_t tick;
+    vector<pair<int, Command>> commands;
+    Keyframe keyframe;
+    while (!reader.atEnd()) {
+        const size_t offset = reader.position();
+        const uint8_t type = reader.u8();
+        if (type == replay::RecordTick) {
+            int playerCount;
+            if (!readTick(&reader, &tick, &playerCount, &commands)) {
+                break;
+            }
+            m_lastTick = tick;
+        } else if (type == replay::RecordKeyframe) {
+            if (!readKeyframe(&reader, &keyframe)) {
+                break;
+            }
+            m_keyframes.push_back({ keyframe.tick, offset });
+            m_lastTick = max<long>(m_lastTick, keyframe.tick);
+        } else {
+            break;
+        }
+    }
+
+    if (m_keyframes.empty()) {
+        m_error = "No keyframes in replay";
+        return false;
+    }
+    return true;
+}
+
+void Replay::createWorld()
+{
+    m_world = make_unique<World>(m_size, m_seed);
+    if (m_commandBudget > 0) {
+        m_world->setCommandBudget(m_commandBudget);
+    }
+    m_world->setRectangles(m_rectangles);
+}
+
+bool Replay::seek(const long tick)
+{
+    if (tick < firstTick() || tick > lastTick()) {
+        m_error = "Tick " + to_string(tick) + " is outside the replay";
+        return false;
+    }
+
+    // Keyframes are evenly spaced, except the last one written at game over
+    size_t index = min<size_t>((tick - firstTick()) / m_keyframeInterval, m_keyframes.size() - 1);
+    while (index > 0 && long(m_keyframes[index].first) > tick) {
+        index--;
+    }
+
+    protocol::Reader reader(m_data, m_dataSize);
+    reader.seek(m_keyframes[index].second);
+    Keyframe keyframe;
+    if (reader.u8() != replay::RecordKeyframe || !readKeyframe(&reader, &keyframe)) {
+        m_error = "Corrupt keyframe";
+        return false;
+    }
+    restoreKeyframe(keyframe);
+    m_position = reader.position();
+    m_lastCommands.clear();
+
+    while (m_world->tickCount() < tick) {
+        if (!step()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Replay::step()
+{
+    protocol::Reader reader(m_data, m_dataSize);
+    reader.seek(m_position);
+
+    uint8_t type = reader.u8();
+    while (type == replay::RecordKeyframe) {
+        Keyframe keyframe;
+        if (!readKeyframe(&reader, &keyframe)) {
+            m_error = "Corrupt keyframe";
+            return false;
+        }
+        if (m_verify && long(keyframe.tick) == m_world->tickCount()) {
+            verifyKeyframe(keyframe);
+        }
+        m_position = reader.position();
+        type = reader.u8();
+    }
+
+    if (type != replay::RecordTick || !reader.ok()) {
+        // End of the replay
+        return false;
+    }
+
+    uint32_t tick;
+    int playerCount;
+    if (!readTick(&reader, &tick, &playerCount, &m_lastCommands)) {
+        m_error = "Corrupt tick";
+        return false;
+    }
+
+    // Players that joined this tick, they get the same spawn points since
+    // the random state is the same
+    while (int(m_world->m_players.size()) < playerCount) {
+        m_world->addPlayer();
+    }
+
+    // Checked before anything is queued, lastCommands() is indexed by them too
+    for (const pair<int, Command> &command : m_lastCommands) {
+        if (command.first >= int(m_world->m_players.size())) {
+            m_lastCommands.clear();
+            m_error = "Command for a player that isn't in the replay";
+            return false;
+        }
+    }
+
+    for (const pair<int, Command> &command : m_lastCommands) {
+        m_world->m_players[command.first]->queueCommand(command.second);
+    }
+
+    // Only ticks that ran are recorded
+    m_world->m_running = true;
+    m_world->tick();
+
+    m_position = reader.position();
+    return true;
+}
+
+bool Replay::readTick(protocol::Reader *reader, uint32_t *tick, int *playerCount, vector<pair<int, Command>> *commands)
+{
+    *tick = reader->u32();
+    *playerCount = reader->u16();
+
+    const uint16_t commandCount = reader->u16();
+    if (!reader->fits(commandCount, s_commandSize)) {
+        return false;
+    }
+    commands->resize(commandCount);
+    for (pair<int, Command> &command : *commands) {
+        command.first = reader->u16();
+        command.second = Command();
+        command.second.type = Command::Type(reader->u8());
+        if (command.second.type == Command::PointAt) {
+            command.second.x = readFloat(reader);
+            command.second.y = readFloat(reader);
+        } else if (command.second.type == Command::Name) {
+            const uint8_t length = reader->u8();
+            const char *name = reader->bytes(length);
+            if (name) {
+                command.second.setText(string_view(name, length));
+            }
+        }
+    }
+
+    return reader->ok();
+}
+
+bool Replay::readKeyframe(protocol::Reader *reader, Keyframe *keyframe)
+{
+    keyframe->tick = reader->u32();
+    keyframe->random = reader->u64();
+    keyframe->nextPlayerId = reader->i32();
+    keyframe->nextBulletId = reader->i32();
+    keyframe->flags = reader->u8();
+
+    const uint16_t playerCount = reader->u16();
+    if (!reader->fits(playerCount, s_playerSize)) {
+        return false;
+    }
+    keyframe->players.resize(playerCount);
+    for (Keyframe::Player &player : keyframe->players) {
+        player.id = reader->i32();
+        player.alive = reader->u8();
+        player.position = readVec2(reader);
+        player.cursorPosition = readVec2(reader);
+        player.rotation = readFloat(reader);
+        const uint8_t length = reader->u8();
+        const char *name = reader->bytes(length);
+        player.name = name ? string(name, length) : string();
+
+        const uint16_t bulletCount = reader->u16();
+        if (!reader->fits(bulletCount, s_bulletSize)) {
+            return false;
+        }
+        player.bullets.resize(bulletCount);
+        for (Keyframe::Bullet &bullet : player.bullets) {
+            bullet.id = reader->i32();
+            bullet.origin = readVec2(reader);
+            bullet.velocity = readVec2(reader);
+            bullet.position = readVec2(reader);
+            bullet.target = readVec2(reader);
+            bullet.flightTime = readFloat(reader);
+            bullet.duration = readFloat(reader);
+            bullet.flags = reader->u8();
+        }
+    }
+
+    return reader->ok();
+}
+
+void Replay::restoreKeyframe(const Keyframe &keyframe)
+{
+    // Players can not be taken out of a world
+    if (m_world->m_players.size() > keyframe.players.size()) {
+        createWorld();
+    }
+    while (m_world->m_players.size() < keyframe.players.size()) {
+        m_world->addPlayer();
+    }
+
+    for (size_t i=0; i<keyframe.players.size(); i++) {
+        const Keyframe::Player &state = keyframe.players[i];
+        Player &player = *m_world->m_players[i];
+
+        player.m_position = state.position;
+        player.m_cursorPosition = state.cursorPosition;
+        player.m_rotation = state.rotation;
+        player.m_dead = !state.alive;
+        player.setName(state.name);
+        while (player.m_commands.front()) {
+            player.m_commands.pop();
+        }
+
+        player.removeBullets();
+        for (const Keyframe::Bullet &bulletState : state.bullets) {
+            BulletStore::State bullet;
+            bullet.id = bulletState.id;
+            bullet.owner = &player;
+            bullet.origin = bulletState.origin;
+            bullet.velocity = bulletState.velocity;
+            bullet.position = bulletState.position;
+            bullet.target = bulletState.target;
+            bullet.flightTime = bulletState.flightTime;
+            bullet.duration = bulletState.duration;
+            bullet.startedInside = bulletState.flags & 1;
+            bullet.flying = bulletState.flags & 2;
+            player.m_bullets.push_back(m_world->m_bullets.add(bullet));
+        }
+    }
+
+    m_world->m_tickCount = keyframe.tick;
+    m_world->m_random.setState(keyframe.random);
+    m_world->m_nextPlayerId = keyframe.nextPlayerId;
+    m_world->m_nextBulletId = keyframe.nextBulletId;
+    m_world->m_running = keyframe.flags & 1;
+    m_world->m_gameOver = keyframe.flags & 2;
+    m_world->m_snapshots.clear();
+    m_world->markPlayersChanged();
+    m_world->updatePlayerGrid();
+}
+
+bool Replay::verifyKeyframe(const Keyframe &keyframe)
+{
+    bool matches = keyframe.players.size() == m_world->m_players.size();
+    for (size_t i=0; matches && i<keyframe.players.size(); i++) {
+        const Keyframe::Player &state = keyframe.players[i];
+        const Player &player = *m_world->m_players[i];
+        matches = state.position == player.position() &&
+                  state.cursorPosition == player.cursorPosition() &&
+                  state.alive == player.isAlive() &&
+                  state.bullets.size() == player.bullets().size();
+    }
+    matches = matches && keyframe.nextBulletId == m_world->m_nextBulletId &&
+              keyframe.random == m_world->m_random.state();
+
+    if (!matches) {
+        cerr << "Replay differs from the recording at tick " << keyframe.tick << endl;
+        m_mismatches++;
+    }
+    return matches;
+}
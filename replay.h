@@ -0,0 +1,157 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "commandparser.h"
+#include "geometry.h"
+#include "protocol.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class World;
+
+using namespace std;
+
+// A recorded game is the commands that were applied each tick plus a full
+// keyframe of the state every keyframeInterval ticks, so playing it back is
+// re-simulating from the closest keyframe. Everything is little-endian.
+//
+// Header:
+//   char magic[4] "TGRP", u16 version, u32 seed, f32 width, f32 height,
+//   u16 command budget, u16 keyframe interval,
+//   u16 count, rectangle[count] (f32 left, f32 top, f32 right, f32 bottom)
+//
+// Then records, each starting with a u8 type:
+//   RecordTick: u32 tick, u16 players after joins, u16 count, command[count]
+//     command: u16 player id, u8 type, then f32 x, f32 y for PointAt or
+//              u8 length, char[length] for Name
+//   RecordKeyframe, the state after a tick:
+//     u32 tick, u64 random state, i32 next player id, i32 next bullet id,
+//     u8 flags (running, game over), u16 count, player[count]
+//     player: i32 id, u8 alive, f32 x, f32 y, f32 pointing_at_x,
+//             f32 pointing_at_y, f32 rotation, u8 length, char name[length],
+//             u16 count, bullet[count]
+//     bullet: i32 id, f32 origin x, y, f32 velocity x, y, f32 x, f32 y,
+//             f32 target x, y, f32 flight time, f32 duration,
+//             u8 flags (started inside, flying)
+//   RecordEnd: u32 count, keyframe[count] (u32 tick, u64 offset),
+//              u64 offset of the RecordEnd, char magic[4] "TGRI"
+//
+// The first keyframe is written when recording starts and the last when the
+// game is over. A file without RecordEnd (the server crashed) is still
+// readable, the keyframes are found by going through the records.
+namespace replay {
+
+enum RecordType {
+    RecordTick = 1,
+    RecordKeyframe = 2,
+    RecordEnd = 3
+};
+
+static constexpr uint16_t version = 2;
+static constexpr int keyframeInterval = 250;
+
+}
+
+class ReplayRecorder
+{
+public:
+    // Writes the header and the first keyframe, takes over the file
+    ReplayRecorder(FILE *file, const World &world);
+
+    // Finishes and closes the file if finish() was not called
+    ~ReplayRecorder();
+
+    // Called at the start of World::tick(), before anything is applied
+    void beginTick(const World &world);
+    void addCommand(const int playerId, const Command &command);
+
+    // Writes the last tick, a keyframe and the index
+    void finish(const World &world);
+
+private:
+    void writeTick(const World &world);
+    void writeKeyframe(const World &world);
+    void flush();
+
+    FILE *m_file;
+    vector<char> m_buffer;
+    uint64_t m_offset = 0;
+    bool m_finished = false;
+
+    long m_tick = -1;
+    long m_firstKeyframeTick = 0;
+    vector<pair<int, Command>> m_commands;
+    vector<pair<uint32_t, uint64_t>> m_keyframes;
+};
+
+class Replay
+{
+public:
+    Replay();
+    ~Replay();
+
+    bool open(const string &path);
+    const string &errorString() const { return m_error; }
+
+    uint32_t seed() const { return m_seed; }
+    Vec2 size() const { return m_size; }
+    long firstTick() const;
+    long lastTick() const;
+
+    // The world the replay plays out in, it is replaced when seeking back to
+    // before a player joined
+    World *world() { return m_world.get(); }
+
+    // Puts the world in the state after tick, from the closest keyframe
+    // before it
+    bool seek(const long tick);
+
+    // Simulates the next tick, false at the end
+    bool step();
+
+    // What was applied in the last step(), player id and command
+    const vector<pair<int, Command>> &lastCommands() const { return m_lastCommands; }
+
+    // Compares the re-simulated state to the keyframes passed by step()
+    void setVerify(const bool verify) { m_verify = verify; }
+    int mismatches() const { return m_mismatches; }
+
+private:
+    struct Keyframe;
+
+    bool readHeader();
+    bool buildIndex();
+    void createWorld();
+    static bool readTick(protocol::Reader *reader, uint32_t *tick, int *playerCount, vector<pair<int, Command>> *commands);
+    static bool readKeyframe(protocol::Reader *reader, Keyframe *keyframe);
+    void restoreKeyframe(const Keyframe &keyframe);
+    bool verifyKeyframe(const Keyframe &keyframe);
+
+    struct MappedFile;
+    unique_ptr<MappedFile> m_file;
+    const char *m_data = nullptr;
+    size_t m_dataSize = 0;
+    size_t m_recordsOffset = 0;
+    size_t m_position = 0;
+    string m_error;
+
+    uint32_t m_seed = 0;
+    Vec2 m_size;
+    int m_commandBudget = 0;
+    int m_keyframeInterval = 0;
+    vector<Rect> m_rectangles;
+    vector<pair<uint32_t, uint64_t>> m_keyframes;
+    long m_lastTick = 0;
+
+    unique_ptr<World> m_world;
+    vector<pair<int, Command>> m_lastCommands;
+    bool m_verify = false;
+    int m_mismatches = 0;
+};
+
+#endif // REPLAY_H
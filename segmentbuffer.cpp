@@ -0,0 +1,250 @@
+#include "segmentbuffer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(HAVE_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+// All kernels do exactly the same operations in the same order, so they give
+// bit-identical results. This file must not be built with FMA contraction.
+
+namespace {
+
+struct Ray
+{
+    float ox, oy, dx, dy;
+};
+
+float nearestScalar(const float *ax, const float *ay, const float *sx, const float *sy, const size_t count,
+                    const Ray &ray, int *index)
+{
+    float best = numeric_limits<float>::infinity();
+    int bestIndex = -1;
+
+    for (size_t i=0; i<count; i++) {
+        const float denominator = ray.dx * sy[i] - ray.dy * sx[i];
+        if (denominator == 0) {
+            continue;
+        }
+        const float wx = ax[i] - ray.ox;
+        const float wy = ay[i] - ray.oy;
+        const float t = (wx * sy[i] - wy * sx[i]) / denominator;
+        const float u = (wx * ray.dy - wy * ray.dx) / denominator;
+
+        if (t > 0 && u >= 0 && u <= 1 && t < best) {
+            best = t;
+            bestIndex = i;
+        }
+    }
+
+    *index = bestIndex;
+    return best;
+}
+
+// Each lane keeps the first closest hit it saw, so picking the smallest
+// distance and then the lowest index gives the same as the scalar loop.
+float reduceLanes(const float *distances, const int *indices, const int lanes, int *index)
+{
+    float best = numeric_limits<float>::infinity();
+    int bestIndex = -1;
+    for (int lane=0; lane<lanes; lane++) {
+        if (indices[lane] < 0) {
+            continue;
+        }
+        if (distances[lane] < best || (distances[lane] == best && indices[lane] < bestIndex)) {
+            best = distances[lane];
+            bestIndex = indices[lane];
+        }
+    }
+    *index = bestIndex;
+    return best;
+}
+
+#ifdef HAVE_SSE2
+inline void sse2Lanes(const float *ax, const float *ay, const float *sx, const float *sy,
+                      const __m128 &ox, const __m128 &oy, const __m128 &dx, const __m128 &dy,
+                      const __m128i &laneIndex, __m128 &best, __m128i &bestIndex)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+
+    const __m128 vsx = _mm_loadu_ps(sx);
+    const __m128 vsy = _mm_loadu_ps(sy);
+    const __m128 denominator = _mm_sub_ps(_mm_mul_ps(dx, vsy), _mm_mul_ps(dy, vsx));
+    const __m128 wx = _mm_sub_ps(_mm_loadu_ps(ax), ox);
+    const __m128 wy = _mm_sub_ps(_mm_loadu_ps(ay), oy);
+    const __m128 t = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(wx, vsy), _mm_mul_ps(wy, vsx)), denominator);
+    const __m128 u = _mm_div_ps(_mm_sub_ps(_mm_mul_ps(wx, dy), _mm_mul_ps(wy, dx)), denominator);
+
+    __m128 valid = _mm_cmpneq_ps(denominator, zero);
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(t, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(u, one));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(t, best));
+
+    best = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, best));
+    const __m128i validMask = _mm_castps_si128(valid);
+    bestIndex = _mm_or_si128(_mm_and_si128(validMask, laneIndex), _mm_andnot_si128(validMask, bestIndex));
+}
+
+float nearestSSE2(const float *ax, const float *ay, const float *sx, const float *sy, const size_t count,
+                  const Ray &ray, int *index)
+{
+    const __m128 ox = _mm_set1_ps(ray.ox);
+    const __m128 oy = _mm_set1_ps(ray.oy);
+    const __m128 dx = _mm_set1_ps(ray.dx);
+    const __m128 dy = _mm_set1_ps(ray.dy);
+
+    __m128 bestLow = _mm_set1_ps(numeric_limits<float>::infinity());
+    __m128 bestHigh = bestLow;
+    __m128i indexLow = _mm_set1_epi32(-1);
+    __m128i indexHigh = indexLow;
+
+    __m128i laneLow = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i laneHigh = _mm_setr_epi32(4, 5, 6, 7);
+    const __m128i step = _mm_set1_epi32(8);
+
+    for (size_t i=0; i<count; i+=8) {
+        sse2Lanes(ax + i, ay + i, sx + i, sy + i, ox, oy, dx, dy, laneLow, bestLow, indexLow);
+        sse2Lanes(ax + i + 4, ay + i + 4, sx + i + 4, sy + i + 4, ox, oy, dx, dy, laneHigh, bestHigh, indexHigh);
+        laneLow = _mm_add_epi32(laneLow, step);
+        laneHigh = _mm_add_epi32(laneHigh, step);
+    }
+
+    float distances[8];
+    int indices[8];
+    _mm_storeu_ps(distances, bestLow);
+    _mm_storeu_ps(distances + 4, bestHigh);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices), indexLow);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices + 4), indexHigh);
+    return reduceLanes(distances, indices, 8, index);
+}
+#endif // HAVE_SSE2
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+float nearestAVX2(const float *ax, const float *ay, const float *sx, const float *sy, const size_t count,
+                  const Ray &ray, int *index)
+{
+    const __m256 ox = _mm256_set1_ps(ray.ox);
+    const __m256 oy = _mm256_set1_ps(ray.oy);
+    const __m256 dx = _mm256_set1_ps(ray.dx);
+    const __m256 dy = _mm256_set1_ps(ray.dy);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+
+    __m256 best = _mm256_set1_ps(numeric_limits<float>::infinity());
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i step = _mm256_set1_epi32(8);
+
+    for (size_t i=0; i<count; i+=8) {
+        const __m256 vsx = _mm256_loadu_ps(sx + i);
+        const __m256 vsy = _mm256_loadu_ps(sy + i);
+        const __m256 denominator = _mm256_sub_ps(_mm256_mul_ps(dx, vsy), _mm256_mul_ps(dy, vsx));
+        const __m256 wx = _mm256_sub_ps(_mm256_loadu_ps(ax + i), ox);
+        const __m256 wy = _mm256_sub_ps(_mm256_loadu_ps(ay + i), oy);
+        const __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(wx, vsy), _mm256_mul_ps(wy, vsx)), denominator);
+        const __m256 u = _mm256_div_ps(_mm256_sub_ps(_mm256_mul_ps(wx, dy), _mm256_mul_ps(wy, dx)), denominator);
+
+        __m256 valid = _mm256_cmp_ps(denominator, zero, _CMP_NEQ_UQ);
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+        valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, best, _CMP_LT_OQ));
+
+        best = _mm256_blendv_ps(best, t, valid);
+        bestIndex = _mm256_blendv_epi8(bestIndex, lane, _mm256_castps_si256(valid));
+        lane = _mm256_add_epi32(lane, step);
+    }
+
+    float distances[8];
+    int indices[8];
+    _mm256_storeu_ps(distances, best);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(indices), bestIndex);
+    return reduceLanes(distances, indices, 8, index);
+}
+#endif // HAVE_AVX2
+
+}
+
+void SegmentBuffer::assign(const vector<Segment> &segments)
+{
+    m_size = segments.size();
+
+    const size_t padded = (m_size + 7) & ~size_t(7);
+    m_ax.assign(padded, 0.f);
+    m_ay.assign(padded, 0.f);
+    m_sx.assign(padded, 0.f);
+    m_sy.assign(padded, 0.f);
+
+    for (size_t i=0; i<m_size; i++) {
+        m_ax[i] = segments[i].a.x;
+        m_ay[i] = segments[i].a.y;
+        m_sx[i] = segments[i].b.x - segments[i].a.x;
+        m_sy[i] = segments[i].b.y - segments[i].a.y;
+    }
+}
+
+float SegmentBuffer::nearest(const Vec2 &origin, const Vec2 &direction, int *index, Kernel kernel) const
+{
+    int dummy;
+    if (!index) {
+        index = &dummy;
+    }
+
+    if (kernel == Best) {
+        kernel = bestKernel();
+    }
+
+    const Ray ray = { origin.x, origin.y, direction.x, direction.y };
+    const size_t padded = m_ax.size();
+
+    switch(kernel) {
+#ifdef HAVE_AVX2
+    case AVX2:
+        return nearestAVX2(m_ax.data(), m_ay.data(), m_sx.data(), m_sy.data(), padded, ray, index);
+#endif
+#ifdef HAVE_SSE2
+    case SSE2:
+        return nearestSSE2(m_ax.data(), m_ay.data(), m_sx.data(), m_sy.data(), padded, ray, index);
+#endif
+    default:
+        return nearestScalar(m_ax.data(), m_ay.data(), m_sx.data(), m_sy.data(), m_size, ray, index);
+    }
+}
+
+SegmentBuffer::Kernel SegmentBuffer::bestKernel()
+{
+#ifdef HAVE_AVX2
+    static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+    if (hasAVX2) {
+        return AVX2;
+    }
+#endif
+#ifdef HAVE_SSE2
+    return SSE2;
+#else
+    return Scalar;
+#endif
+}
+
+const char *SegmentBuffer::kernelName(const Kernel kernel)
+{
+    switch(kernel) {
+    case Scalar:
+        return "scalar";
+    case SSE2:
+        return "sse2";
+    case AVX2:
+        return "avx2";
+    case Best:
+        return kernelName(bestKernel());
+    }
+    return "unknown";
+}
@@ -0,0 +1,66 @@
+#ifndef SEGMENTBUFFER_H
+#define SEGMENTBUFFER_H
+
+#include "geometry.h"
+
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+// Where a ray from origin along direction hits the line through the segment
+// starting at a with delta s, as a multiple of direction. This is exactly
+// what the vectorized kernels compute per lane, so results are identical.
+inline float rayDistance(const float ox, const float oy, const float dx, const float dy,
+                         const float ax, const float ay, const float sx, const float sy)
+{
+    const float denominator = dx * sy - dy * sx;
+    if (denominator == 0) {
+        return numeric_limits<float>::infinity();
+    }
+    return ((ax - ox) * sy - (ay - oy) * sx) / denominator;
+}
+
+// Segments stored as structure of arrays, padded with empty segments to a
+// multiple of 8, so one ray can be tested against 8 segments at once.
+class SegmentBuffer
+{
+public:
+    enum Kernel {
+        Scalar,
+        SSE2,
+        AVX2,
+        Best
+    };
+
+    void assign(const vector<Segment> &segments);
+
+    size_t size() const { return m_size; }
+    Segment segment(const size_t index) const {
+        return Segment(Vec2(m_ax[index], m_ay[index]), Vec2(m_ax[index] + m_sx[index], m_ay[index] + m_sy[index]));
+    }
+
+    // Distance along the ray to the line through one segment, for when we
+    // already know which segment is hit.
+    float distance(const size_t index, const Vec2 &origin, const Vec2 &direction) const {
+        return rayDistance(origin.x, origin.y, direction.x, direction.y, m_ax[index], m_ay[index], m_sx[index], m_sy[index]);
+    }
+
+    // Closest segment hit by the ray, returns the distance as a multiple of
+    // direction and sets index, or infinity and -1 if nothing is hit. A
+    // segment going through origin is not in front of it, so it isn't hit.
+    float nearest(const Vec2 &origin, const Vec2 &direction, int *index = nullptr, Kernel kernel = Best) const;
+
+    // What Best resolves to on this CPU
+    static Kernel bestKernel();
+    static const char *kernelName(const Kernel kernel);
+
+private:
+    size_t m_size = 0;
+    vector<float> m_ax;
+    vector<float> m_ay;
+    vector<float> m_sx;
+    vector<float> m_sy;
+};
+
+#endif // SEGMENTBUFFER_H
@@ -0,0 +1,152 @@
+#include "matchhost.h"
+
+#include "player.h"
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+
+extern "C" {
+#include <signal.h>
+}
+
+#ifdef _WIN32
+#include <winsock2.h>
+#endif//_WIN32
+
+static std::atomic<bool> s_quit(false);
+
+void sigintHandler(int)
+{
+    s_quit = true;
+}
+
+static void printUsage(const char *name)
+{
+    cerr << "Usage: " << name << " [options]" << endl;
+    cerr << "  --host <host>      Address to listen on (default localhost)" << endl;
+    cerr << "  --port <port>      Port to listen on (default 1337)" << endl;
+    cerr << "  --size <w> <h>     Size of the map (default 1280 720)" << endl;
+    cerr << "  --players <n>      Players at the start (default 3)" << endl;
+    cerr << "  --max-players <n>  Let more clients join mid-game, up to this many players" << endl;
+    cerr << "  --fast             Step ticks as fast as possible instead of at wall-clock rate" << endl;
+    cerr << "  --no-wait          Start ticking without waiting for all players to connect" << endl;
+    cerr << "  --commands <n>     Commands applied per player per tick (default 8)" << endl;
+    cerr << "  --matches <n>      Run this many matches, on port, port + 1 and so on (default 1)" << endl;
+    cerr << "  --join             All matches on one port, bots pick one with JOIN <match>" << endl;
+    cerr << "  --threads <n>      Threads ticking the matches (default one per core)" << endl;
+    cerr << "  --net-threads <n>  Threads for the sockets (default 1, Linux only)" << endl;
+    cerr << "  --tacopie          Use tacopie for the sockets instead of epoll (Linux only)" << endl;
+    cerr << "  --record <file>    Record the match for tg18ai-replay" << endl;
+    cerr << "  --seed <n>         Seed for the map and spawns, the next matches get seed + 1 and so on" << endl;
+    cerr << "  --stats <file>     Write tick timings of every match to the file every 10 seconds" << endl;
+    cerr << "  --stats-interval <n>  Seconds between --stats writes" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    MatchHost::Options options;
+
+    for (int i=1; i<argc; i++) {
+        const string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            options.port = atoi(argv[++i]);
+        } else if (arg == "--size" && i + 2 < argc) {
+            options.size.x = atoi(argv[++i]);
+            options.size.y = atoi(argv[++i]);
+        } else if (arg == "--players" && i + 1 < argc) {
+            options.playerCount = atoi(argv[++i]);
+        } else if (arg == "--max-players" && i + 1 < argc) {
+            options.maxPlayers = atoi(argv[++i]);
+        } else if (arg == "--fast") {
+            options.fast = true;
+        } else if (arg == "--no-wait") {
+            options.waitForPlayers = false;
+        } else if (arg == "--commands" && i + 1 < argc) {
+            options.commandBudget = atoi(argv[++i]);
+        } else if (arg == "--matches" && i + 1 < argc) {
+            options.matchCount = max(atoi(argv[++i]), 1);
+        } else if (arg == "--join") {
+            options.joinRouting = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threadCount = atoi(argv[++i]);
+        } else if (arg == "--net-threads" && i + 1 < argc) {
+            options.networkThreadCount = max(1, atoi(argv[++i]));
+        } else if (arg == "--tacopie") {
+            options.tacopie = true;
+        } else if (arg == "--record" && i + 1 < argc) {
+            options.recordPath = argv[++i];
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--stats" && i + 1 < argc) {
+            options.statsPath = argv[++i];
+        } else if (arg == "--stats-interval" && i + 1 < argc) {
+            options.statsInterval = chrono::seconds(max(1, atoi(argv[++i])));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.size.x > World::maxSize || options.size.y > World::maxSize) {
+        cerr << "The map can be at most " << World::maxSize << " in either direction" << endl;
+        return 1;
+    }
+
+#ifdef _WIN32
+    //! Windows netword DLL init
+    WORD version = MAKEWORD(2, 2);
+    WSADATA data;
+
+    if (WSAStartup(version, &data) != 0) {
+        std::cerr << "WSAStartup() failure" << std::endl;
+        return -1;
+    }
+#endif//_WIN32
+
+    signal(SIGINT, &sigintHandler);
+
+    MatchHost host(options);
+    if (!host.start()) {
+        return 1;
+    }
+
+    if (options.matchCount > 1) {
+        cout << options.matchCount << " matches on " << host.threadCount() << " threads" << endl;
+    }
+
+    host.run(s_quit);
+    const double elapsed = host.elapsedSeconds();
+
+    long totalTicks = 0;
+    for (size_t i=0; i<host.worlds().size(); i++) {
+        const World &world = *host.worlds()[i];
+        totalTicks += world.tickCount();
+
+        const string prefix = options.matchCount > 1 ? "match " + to_string(i) + ": " : string();
+        if (options.matchCount > 1) {
+            cout << prefix << world.tickCount() << " ticks" << endl;
+        }
+        for (const shared_ptr<Player> &player : world.allPlayers()) {
+            if (player->droppedUpdates() > 0) {
+                cout << prefix << player->name() << ": " << player->droppedUpdates() << " updates dropped, too slow reading" << endl;
+            }
+            if (player->overflowedCommands() > 0) {
+                cout << prefix << player->name() << ": " << player->overflowedCommands() << " commands dropped, queue full" << endl;
+            }
+        }
+    }
+    cout << totalTicks << " ticks in " << elapsed << "s";
+    if (options.matchCount > 1) {
+        cout << ", " << totalTicks / elapsed << " match ticks/s";
+    }
+    cout << endl;
+
+#ifdef _WIN32
+    WSACleanup();
+#endif//_WIN32
+
+    return 0;
+}
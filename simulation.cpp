@@ -0,0 +1,128 @@
+#include "simulation.h"
+
+#include "player.h"
+
+Simulation::Simulation(unique_ptr<World> world) :
+    m_world(move(world))
+{
+    m_world->onGameOver = [this](shared_ptr<Player> winner) {
+        m_gameOver = true;
+        m_result = winner ? winner->name() + " won" : "Draw";
+    };
+
+    publish();
+}
+
+Simulation::~Simulation()
+{
+    {
+        lock_guard<mutex> lock(m_inboxMutex);
+        m_quit = true;
+    }
+    m_inboxChanged.notify_one();
+
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void Simulation::start()
+{
+    m_thread = thread(&Simulation::run, this);
+}
+
+void Simulation::post(function<void(World *world)> message)
+{
+    {
+        lock_guard<mutex> lock(m_inboxMutex);
+        m_inbox.push_back(move(message));
+    }
+    m_inboxChanged.notify_one();
+}
+
+shared_ptr<const SceneState> Simulation::state() const
+{
+    lock_guard<mutex> lock(m_stateMutex);
+    return m_state;
+}
+
+void Simulation::run()
+{
+    chrono::steady_clock::time_point nextTick = chrono::steady_clock::now();
+    vector<function<void(World *world)>> messages;
+
+    unique_lock<mutex> lock(m_inboxMutex);
+    while (!m_quit) {
+        swap(messages, m_inbox);
+        lock.unlock();
+
+        for (const function<void(World *world)> &message : messages) {
+            message(m_world.get());
+        }
+
+        const bool ticking = m_world->isRunning() && !m_world->isGameOver();
+        const chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (!ticking) {
+            // Starts right away when unpaused
+            nextTick = now;
+            if (!messages.empty()) {
+                publish();
+            }
+        } else if (now >= nextTick) {
+            m_world->tick();
+            publish();
+
+            // If a tick ran late the next ones are not rushed to catch up
+            nextTick = max(nextTick + World::tickInterval, now);
+        }
+        messages.clear();
+
+        lock.lock();
+        if (m_quit || !m_inbox.empty()) {
+            continue;
+        }
+        if (ticking) {
+            m_inboxChanged.wait_until(lock, nextTick);
+        } else {
+            m_inboxChanged.wait(lock);
+        }
+    }
+}
+
+void Simulation::publish()
+{
+    shared_ptr<SceneState> state = make_shared<SceneState>();
+    state->tick = m_world->tickCount();
+    state->time = chrono::steady_clock::now();
+    state->running = m_world->isRunning();
+    state->gameOver = m_gameOver;
+    state->result = m_result;
+
+    const vector<shared_ptr<Player>> &players = m_world->allPlayers();
+    m_visibility.resize(players.size());
+    m_visibilityRevisions.resize(players.size(), -1);
+    state->players.resize(players.size());
+
+    for (size_t i=0; i<players.size(); i++) {
+        const Player &player = *players[i];
+        SceneState::PlayerState &playerState = state->players[i];
+        playerState.position = player.position();
+        playerState.rotation = player.rotation();
+        playerState.alive = player.isAlive();
+        playerState.name = player.name();
+
+        if (!m_visibility[i] || m_visibilityRevisions[i] != player.visibilityRevision()) {
+            m_visibility[i] = make_shared<const vector<Vec2>>(player.visibilityPolygon());
+            m_visibilityRevisions[i] = player.visibilityRevision();
+        }
+        playerState.visibilityRevision = m_visibilityRevisions[i];
+        playerState.visibility = m_visibility[i];
+
+        player.forEachBullet([&](const Bullet &bullet) {
+            state->bullets.push_back({ bullet.id, int(i), bullet.position() });
+        });
+    }
+
+    lock_guard<mutex> lock(m_stateMutex);
+    m_state = move(state);
+}
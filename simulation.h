@@ -0,0 +1,94 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "world.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// What the viewer draws, copied out of the World after a tick. It never
+// changes once published, so the render thread can keep it as long as it
+// wants without locking anything.
+struct SceneState
+{
+    struct PlayerState {
+        Vec2 position;
+        float rotation = 0;
+        bool alive = true;
+        string name;
+
+        // Shared with the states before it until the polygon changes
+        int visibilityRevision = -1;
+        shared_ptr<const vector<Vec2>> visibility;
+    };
+
+    struct BulletState {
+        int id;
+        // Index into players
+        int owner;
+        Vec2 position;
+    };
+
+    long tick = 0;
+    // When it was published, the viewer moves towards it from then on
+    chrono::steady_clock::time_point time;
+    vector<PlayerState> players;
+    vector<BulletState> bullets;
+
+    bool running = false;
+    bool gameOver = false;
+    // Who won, or "Draw"
+    string result;
+};
+
+// Owns a World and ticks it on its own thread at wall-clock rate, so nothing
+// the render thread does (vsync, a GPU stall, text rendering) can delay a
+// tick. Everyone else talks to the World by posting messages, and gets to see
+// it through the published SceneStates.
+class Simulation
+{
+public:
+    Simulation(unique_ptr<World> world);
+    ~Simulation();
+
+    void start();
+
+    // Run on the simulation thread before the next tick, in the order posted
+    void post(function<void(World *world)> message);
+
+    // The newest state, a new one after every tick
+    shared_ptr<const SceneState> state() const;
+
+    Profiler &profiler() { return m_world->profiler(); }
+
+private:
+    void run();
+    void publish();
+
+    unique_ptr<World> m_world;
+    thread m_thread;
+
+    mutex m_inboxMutex;
+    condition_variable m_inboxChanged;
+    vector<function<void(World *world)>> m_inbox;
+    bool m_quit = false;
+
+    mutable mutex m_stateMutex;
+    shared_ptr<const SceneState> m_state;
+
+    // Only touched by the simulation thread
+    vector<shared_ptr<const vector<Vec2>>> m_visibility;
+    vector<int> m_visibilityRevisions;
+    bool m_gameOver = false;
+    string m_result;
+};
+
+#endif // SIMULATION_H
@@ -0,0 +1,277 @@
+#include "snapshot.h"
+
+#include "world.h"
+#include "player.h"
+
+#include <algorithm>
+
+static const char s_textBegin[] = "{\"type\":\"update\",\"you\":";
+static const char s_textOthers[] = ",\"world\":{\"others\":[";
+static const char s_textSeed[] = "],\"seed\":";
+
+Snapshot::Snapshot(const World &world) :
+    m_tick(world.tickCount()),
+    m_seed(world.seed())
+{
+    const vector<shared_ptr<Player>> &players = world.allPlayers();
+    m_text.reserve(players.size());
+    m_binary.reserve(players.size());
+
+    protocol::Writer writer(&m_joinedBinary);
+    for (const shared_ptr<Player> &player : players) {
+        if (!m_joinedText.empty()) {
+            m_joinedText.push_back(',');
+        }
+        const size_t textOffset = m_joinedText.size();
+        protocol::writeJson(&m_joinedText, *player);
+        m_text.push_back({ textOffset, m_joinedText.size() - textOffset });
+
+        const size_t binaryOffset = m_joinedBinary.size();
+        protocol::writePlayer(&writer, *player);
+        m_binary.push_back({ binaryOffset, m_joinedBinary.size() - binaryOffset });
+    }
+
+    protocol::Writer header(&m_binaryHeader);
+    header.u32(uint32_t(1 + 4 + 4 + 2 + m_joinedBinary.size()));
+    header.u8(protocol::FrameUpdate);
+    header.u32(m_tick);
+    header.u32(m_seed);
+
+    m_textEnd = s_textSeed + to_string(m_seed) + "}}\n";
+
+    protocol::Writer count(&m_binaryCount);
+    count.u16(players.empty() ? 0 : players.size() - 1);
+
+    for (const shared_ptr<Player> &player : players) {
+        m_playerIds.push_back(player->id);
+        m_playerStates.push_back({
+            player->id,
+            uint8_t(player->isAlive()),
+            protocol::quantizePosition(player->position().x),
+            protocol::quantizePosition(player->position().y),
+            protocol::quantizePosition(player->cursorPosition().x),
+            protocol::quantizePosition(player->cursorPosition().y),
+            protocol::quantizeRotation(player->rotation())
+        });
+
+        player->forEachBullet([&](const Bullet &bullet) {
+            m_bulletStates.push_back({
+                bullet.id,
+                player->id,
+                protocol::quantizePosition(bullet.position().x),
+                protocol::quantizePosition(bullet.position().y),
+                protocol::quantizePosition(bullet.target().x),
+                protocol::quantizePosition(bullet.target().y)
+            });
+        });
+    }
+
+    sort(m_playerStates.begin(), m_playerStates.end(), [](const PlayerState &a, const PlayerState &b) {
+        return a.id < b.id;
+    });
+    sort(m_bulletStates.begin(), m_bulletStates.end(), [](const BulletState &a, const BulletState &b) {
+        return a.id < b.id;
+    });
+}
+
+static void writePlayerFields(protocol::Writer *writer, const Snapshot::PlayerState &state, const uint8_t mask)
+{
+    if (mask & protocol::PlayerAlive) writer->u8(state.alive);
+    if (mask & protocol::PlayerX) writer->i16(state.x);
+    if (mask & protocol::PlayerY) writer->i16(state.y);
+    if (mask & protocol::PlayerPointingX) writer->i16(state.pointingX);
+    if (mask & protocol::PlayerPointingY) writer->i16(state.pointingY);
+    if (mask & protocol::PlayerRotation) writer->i16(state.rotation);
+}
+
+static void writeBulletFields(protocol::Writer *writer, const Snapshot::BulletState &state, const uint8_t mask)
+{
+    if (mask & protocol::BulletOwner) writer->i32(state.owner);
+    if (mask & protocol::BulletX) writer->i16(state.x);
+    if (mask & protocol::BulletY) writer->i16(state.y);
+    if (mask & protocol::BulletTargetX) writer->i16(state.targetX);
+    if (mask & protocol::BulletTargetY) writer->i16(state.targetY);
+}
+
+static uint8_t changedFields(const Snapshot::PlayerState &from, const Snapshot::PlayerState &to)
+{
+    uint8_t mask = 0;
+    if (from.alive != to.alive) mask |= protocol::PlayerAlive;
+    if (from.x != to.x) mask |= protocol::PlayerX;
+    if (from.y != to.y) mask |= protocol::PlayerY;
+    if (from.pointingX != to.pointingX) mask |= protocol::PlayerPointingX;
+    if (from.pointingY != to.pointingY) mask |= protocol::PlayerPointingY;
+    if (from.rotation != to.rotation) mask |= protocol::PlayerRotation;
+    return mask;
+}
+
+static uint8_t changedFields(const Snapshot::BulletState &from, const Snapshot::BulletState &to)
+{
+    uint8_t mask = 0;
+    if (from.owner != to.owner) mask |= protocol::BulletOwner;
+    if (from.x != to.x) mask |= protocol::BulletX;
+    if (from.y != to.y) mask |= protocol::BulletY;
+    if (from.targetX != to.targetX) mask |= protocol::BulletTargetX;
+    if (from.targetY != to.targetY) mask |= protocol::BulletTargetY;
+    return mask;
+}
+
+// Both lists are sorted by id, so the removed, new and changed entities fall
+// out of a single merge. Writes the removed ids and then the changes.
+template<typename State, typename WriteFields>
+static void writeChanges(protocol::Writer *writer, const vector<State> &from, const vector<State> &to,
+                         const uint8_t allFields, const WriteFields &writeFields)
+{
+    size_t countPosition = writer->position();
+    writer->u16(0);
+    uint16_t count = 0;
+    size_t j = 0;
+    for (const State &state : from) {
+        while (j < to.size() && to[j].id < state.id) {
+            j++;
+        }
+        if (j == to.size() || to[j].id != state.id) {
+            writer->i32(state.id);
+            count++;
+        }
+    }
+    writer->setU16(countPosition, count);
+
+    countPosition = writer->position();
+    writer->u16(0);
+    count = 0;
+    size_t i = 0;
+    for (const State &state : to) {
+        while (i < from.size() && from[i].id < state.id) {
+            i++;
+        }
+        const uint8_t mask = (i < from.size() && from[i].id == state.id) ? changedFields(from[i], state) : allFields;
+        if (!mask) {
+            continue;
+        }
+        writer->i32(state.id);
+        writer->u8(mask);
+        writeFields(writer, state, mask);
+        count++;
+    }
+    writer->setU16(countPosition, count);
+}
+
+const vector<char> &Snapshot::keyframe() const
+{
+    if (!m_keyframe.empty()) {
+        return m_keyframe;
+    }
+
+    protocol::Writer writer(&m_keyframe);
+    writer.u16(m_playerStates.size());
+    for (const PlayerState &state : m_playerStates) {
+        writer.i32(state.id);
+        writePlayerFields(&writer, state, protocol::PlayerAll);
+    }
+    writer.u16(m_bulletStates.size());
+    for (const BulletState &state : m_bulletStates) {
+        writer.i32(state.id);
+        writeBulletFields(&writer, state, protocol::BulletAll);
+    }
+    return m_keyframe;
+}
+
+const vector<char> &Snapshot::delta(const Snapshot &base) const
+{
+    // Most clients ack the same tick, so they share the encoding
+    map<uint32_t, vector<char>>::iterator it = m_deltas.find(base.tick());
+    if (it != m_deltas.end()) {
+        return it->second;
+    }
+
+    vector<char> &encoded = m_deltas[base.tick()];
+    protocol::Writer writer(&encoded);
+    writeChanges(&writer, base.m_playerStates, m_playerStates, protocol::PlayerAll, writePlayerFields);
+    writeChanges(&writer, base.m_bulletStates, m_bulletStates, protocol::BulletAll, writeBulletFields);
+    return encoded;
+}
+
+UpdateMessage::UpdateMessage(shared_ptr<const Snapshot> snapshot, const size_t playerIndex, const protocol::Protocol protocol,
+                             const Snapshot *base) :
+    m_snapshot(move(snapshot))
+{
+    const Snapshot &state = *m_snapshot;
+    const size_t count = state.playerCount();
+
+    if (protocol == protocol::Delta) {
+        const vector<char> &body = base ? state.delta(*base) : state.keyframe();
+
+        protocol::Writer writer(&m_header);
+        const size_t start = writer.beginFrame();
+        writer.u8(base ? protocol::FrameDelta : protocol::FrameKeyframe);
+        writer.u32(state.tick());
+        if (base) {
+            writer.u32(base->tick());
+        } else {
+            writer.u32(state.seed());
+        }
+        writer.i32(state.m_playerIds[playerIndex]);
+        writer.setU32(start, m_header.size() - start - 4 + body.size());
+
+        add(m_header.data(), m_header.size());
+        add(body.data(), body.size());
+        return;
+    }
+
+    if (protocol == protocol::Binary) {
+        const Snapshot::Fragment &you = state.m_binary[playerIndex];
+        const char *joined = state.m_joinedBinary.data();
+
+        // The others are everything but you, which is at most two slices
+        add(state.m_binaryHeader.data(), state.m_binaryHeader.size());
+        add(joined + you.offset, you.size);
+        add(state.m_binaryCount.data(), state.m_binaryCount.size());
+        add(joined, you.offset);
+        add(joined + you.offset + you.size, state.m_joinedBinary.size() - you.offset - you.size);
+        return;
+    }
+
+    const Snapshot::Fragment &you = state.m_text[playerIndex];
+    const char *joined = state.m_joinedText.data();
+
+    add(s_textBegin, sizeof(s_textBegin) - 1);
+    add(joined + you.offset, you.size);
+    add(s_textOthers, sizeof(s_textOthers) - 1);
+
+    // Skip the comma on one side of you, when there is another player there
+    if (playerIndex > 0) {
+        add(joined, you.offset - 1);
+        if (playerIndex + 1 < count) {
+            add(joined + you.offset + you.size, state.m_joinedText.size() - you.offset - you.size);
+        }
+    } else if (count > 1) {
+        add(joined + you.size + 1, state.m_joinedText.size() - you.size - 1);
+    }
+
+    add(state.m_textEnd.data(), state.m_textEnd.size());
+}
+
+size_t UpdateMessage::size() const
+{
+    size_t total = 0;
+    for (const Snapshot::Slice &slice : m_slices) {
+        total += slice.size;
+    }
+    return total;
+}
+
+void UpdateMessage::copyTo(vector<char> *buffer) const
+{
+    buffer->reserve(buffer->size() + size());
+    for (const Snapshot::Slice &slice : m_slices) {
+        buffer->insert(buffer->end(), slice.data, slice.data + slice.size);
+    }
+}
+
+void UpdateMessage::add(const char *data, const size_t size)
+{
+    if (size > 0) {
+        m_slices.push_back({ data, size });
+    }
+}
@@ -0,0 +1,110 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "protocol.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class World;
+
+// Everything sent to the bots for one tick. Each player is encoded exactly
+// once, in both the text and the binary protocol, and every client's update
+// is put together from these shared fragments.
+class Snapshot
+{
+public:
+    typedef protocol::Slice Slice;
+
+    Snapshot(const World &world);
+
+    uint32_t tick() const { return m_tick; }
+    uint32_t seed() const { return m_seed; }
+    size_t playerCount() const { return m_text.size(); }
+
+    // The quantized state for PROTOCOL DELTA
+    struct PlayerState {
+        int32_t id;
+        uint8_t alive;
+        int16_t x, y, pointingX, pointingY, rotation;
+    };
+    struct BulletState {
+        int32_t id;
+        int32_t owner;
+        int16_t x, y, targetX, targetY;
+    };
+
+    // Both are sorted by id
+    const vector<PlayerState> &playerStates() const { return m_playerStates; }
+    const vector<BulletState> &bulletStates() const { return m_bulletStates; }
+
+    // Frame bodies without the per-client header, encoded the first time a
+    // client needs them and then shared. Only used from the tick.
+    const vector<char> &keyframe() const;
+    const vector<char> &delta(const Snapshot &base) const;
+
+private:
+    friend class UpdateMessage;
+
+    struct Fragment {
+        size_t offset;
+        size_t size;
+    };
+
+    uint32_t m_tick;
+    uint32_t m_seed;
+
+    // All the players in World order, joined with "," for the text protocol,
+    // so everyone but one player is at most two slices.
+    string m_joinedText;
+    vector<Fragment> m_text;
+
+    // Closes the text update, with the seed of the world
+    string m_textEnd;
+
+    vector<char> m_joinedBinary;
+    vector<Fragment> m_binary;
+
+    // Every frame has the same length and count, so they are shared too
+    vector<char> m_binaryHeader;
+    vector<char> m_binaryCount;
+
+    vector<int32_t> m_playerIds; // World order
+    vector<PlayerState> m_playerStates;
+    vector<BulletState> m_bulletStates;
+
+    mutable vector<char> m_keyframe;
+    mutable map<uint32_t, vector<char>> m_deltas;
+};
+
+// The update for one player, as slices pointing into a shared snapshot that
+// it keeps alive until the message is gone.
+class UpdateMessage
+{
+public:
+    // With PROTOCOL DELTA it is a delta against base, or a keyframe if base is null
+    UpdateMessage(shared_ptr<const Snapshot> snapshot, const size_t playerIndex, const protocol::Protocol protocol,
+                  const Snapshot *base = nullptr);
+    UpdateMessage(const UpdateMessage &) = delete;
+    UpdateMessage(UpdateMessage &&) = default; // moving a vector keeps its storage, so the slices stay valid
+
+    const vector<Snapshot::Slice> &slices() const { return m_slices; }
+    size_t size() const;
+
+    void copyTo(vector<char> *buffer) const;
+
+private:
+    void add(const char *data, const size_t size);
+
+    shared_ptr<const Snapshot> m_snapshot;
+
+    // The delta frame header is the only thing unique to a client
+    vector<char> m_header;
+    vector<Snapshot::Slice> m_slices;
+};
+
+#endif // SNAPSHOT_H
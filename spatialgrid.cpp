@@ -0,0 +1,49 @@
+#include "spatialgrid.h"
+
+SpatialGrid::SpatialGrid(const Vec2 &size, const float cellSize) :
+    m_cellSize(cellSize)
+{
+    resize(size);
+}
+
+void SpatialGrid::resize(const Vec2 &size)
+{
+    m_columns = std::max(1, int(std::ceil(size.x / m_cellSize)));
+    m_rows = std::max(1, int(std::ceil(size.y / m_cellSize)));
+    m_cells.assign(m_columns * m_rows, vector<int>());
+    m_stamps.clear();
+}
+
+void SpatialGrid::clear()
+{
+    // Keep the capacity, the player grid is rebuilt every tick
+    for (vector<int> &cell : m_cells) {
+        cell.clear();
+    }
+}
+
+void SpatialGrid::insert(const int item, const Rect &bounds)
+{
+    if (item >= int(m_stamps.size())) {
+        m_stamps.resize(item + 1, m_stamp);
+    }
+
+    const int x1 = column(bounds.tl.x), x2 = column(bounds.br.x);
+    const int y1 = row(bounds.tl.y), y2 = row(bounds.br.y);
+    for (int y=y1; y<=y2; y++) {
+        for (int x=x1; x<=x2; x++) {
+            m_cells[cellIndex(x, y)].push_back(item);
+        }
+    }
+}
+
+uint32_t SpatialGrid::nextStamp() const
+{
+    m_stamp++;
+    if (m_stamp == 0) {
+        // Wrapped around, old stamps could collide
+        std::fill(m_stamps.begin(), m_stamps.end(), 0);
+        m_stamp = 1;
+    }
+    return m_stamp;
+}
@@ -0,0 +1,92 @@
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include "geometry.h"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Uniform grid of item indices, for finding what is near a point, an area
+// or a segment without scanning everything. Items are stored in every cell
+// their bounds overlap, queries report each item only once.
+class SpatialGrid
+{
+public:
+    SpatialGrid(const Vec2 &size = Vec2(), const float cellSize = 64);
+
+    void resize(const Vec2 &size);
+    void clear();
+    void insert(const int item, const Rect &bounds);
+
+    template<typename Callback>
+    void queryPoint(const Vec2 &point, Callback &&callback) const {
+        if (m_cells.empty()) {
+            return;
+        }
+        for (const int item : m_cells[cellIndex(column(point.x), row(point.y))]) {
+            callback(item);
+        }
+    }
+
+    // Stops early if the callback returns true
+    template<typename Callback>
+    bool query(const Rect &area, Callback &&callback) const {
+        if (m_cells.empty()) {
+            return false;
+        }
+
+        const uint32_t stamp = nextStamp();
+        const int x1 = column(area.tl.x), x2 = column(area.br.x);
+        const int y1 = row(area.tl.y), y2 = row(area.br.y);
+        for (int y=y1; y<=y2; y++) {
+            for (int x=x1; x<=x2; x++) {
+                for (const int item : m_cells[cellIndex(x, y)]) {
+                    if (m_stamps[item] == stamp) {
+                        continue;
+                    }
+                    m_stamps[item] = stamp;
+                    if (callback(item)) {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    template<typename Callback>
+    bool querySegment(const Vec2 &from, const Vec2 &to, Callback &&callback) const {
+        return query(Rect(Vec2(std::min(from.x, to.x), std::min(from.y, to.y)),
+                          Vec2(std::max(from.x, to.x), std::max(from.y, to.y))),
+                     callback);
+    }
+
+private:
+    int column(const float x) const { return cellFor(x, m_columns); }
+    int row(const float y) const { return cellFor(y, m_rows); }
+
+    // Clamped before converting, a bot can send coordinates that don't fit
+    // in an int. NaN is treated like anything else outside the grid.
+    int cellFor(const float coordinate, const int count) const {
+        const float cell = coordinate / m_cellSize;
+        if (!(cell > 0)) {
+            return 0;
+        }
+        return int(std::min(cell, float(count - 1)));
+    }
+    int cellIndex(const int x, const int y) const { return y * m_columns + x; }
+    uint32_t nextStamp() const;
+
+    float m_cellSize;
+    int m_columns = 0;
+    int m_rows = 0;
+    vector<vector<int>> m_cells;
+
+    // For deduplicating items spanning several cells, so queries are not reentrant
+    mutable vector<uint32_t> m_stamps;
+    mutable uint32_t m_stamp = 0;
+};
+
+#endif // SPATIALGRID_H
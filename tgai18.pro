@@ -8,8 +8,22 @@ CONFIG -= qt
 
 SOURCES += main.cpp \
     gamewindow.cpp \
-    polygonnode.cpp \
-    player.cpp
+    simulation.cpp \
+    playernode.cpp \
+    polygonbatchnode.cpp \
+    bulletlayernode.cpp \
+    world.cpp \
+    spatialgrid.cpp \
+    visibility.cpp \
+    segmentbuffer.cpp \
+    protocol.cpp \
+    snapshot.cpp \
+    replay.cpp \
+    profiler.cpp \
+    connection.cpp \
+    commandparser.cpp \
+    player.cpp \
+    bulletstore.cpp
 
 LIBS += -lSDL2 -lpthread
 
@@ -33,8 +47,25 @@ INCLUDEPATH += extern/rengine/include/ extern/rengine/3rdparty/ extern/ /usr/inc
 
 HEADERS += \
     gamewindow.h \
-    polygonnode.h \
-    player.h
+    simulation.h \
+    geometry.h \
+    playernode.h \
+    polygonbatchnode.h \
+    bulletlayernode.h \
+    world.h \
+    spatialgrid.h \
+    visibility.h \
+    segmentbuffer.h \
+    protocol.h \
+    commandqueue.h \
+    commandparser.h \
+    snapshot.h \
+    replay.h \
+    random.h \
+    profiler.h \
+    connection.h \
+    player.h \
+    bulletstore.h
 
 
 include(extern/tacopie.pri)
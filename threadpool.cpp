@@ -0,0 +1,109 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int threadCount) :
+    m_nextWorker(0)
+{
+    if (threadCount <= 0) {
+        threadCount = max(1u, thread::hardware_concurrency());
+    }
+
+    for (int i=0; i<threadCount; i++) {
+        m_workers.push_back(make_unique<Worker>());
+    }
+    for (int i=0; i<threadCount; i++) {
+        m_threads.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+
+    for (thread &thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    Worker &worker = *m_workers[m_nextWorker++ % m_workers.size()];
+    {
+        lock_guard<mutex> lock(worker.lock);
+        worker.tasks.push_back(move(task));
+    }
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_queued++;
+        m_pending++;
+    }
+    m_wake.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_done.wait(lock, [this]() { return m_pending == 0; });
+}
+
+bool ThreadPool::takeTask(const size_t index, function<void()> *task)
+{
+    // Own queue from the back, it is the most likely to be warm in the cache
+    {
+        Worker &worker = *m_workers[index];
+        lock_guard<mutex> lock(worker.lock);
+        if (!worker.tasks.empty()) {
+            *task = move(worker.tasks.back());
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i=1; i<m_workers.size(); i++) {
+        Worker &victim = *m_workers[(index + i) % m_workers.size()];
+        lock_guard<mutex> lock(victim.lock);
+        if (!victim.tasks.empty()) {
+            *task = move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::run(const size_t index)
+{
+    function<void()> task;
+    while (true) {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_queued > 0 || m_quit; });
+            if (m_queued == 0) {
+                return;
+            }
+            m_queued--;
+        }
+
+        // Someone is guaranteed to have it, since it was counted as queued
+        while (!takeTask(index, &task)) {
+            this_thread::yield();
+        }
+
+        task();
+        task = nullptr;
+
+        bool done;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            done = --m_pending == 0;
+        }
+        if (done) {
+            m_done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Work-stealing thread pool. submit() spreads the tasks round robin over the
+// workers' own queues, a worker takes its newest task first and steals the
+// oldest from the others when it runs dry, so a few slow tasks do not leave
+// the rest of the cores idle. Sleeping and waking up goes through one shared
+// count of queued tasks.
+class ThreadPool
+{
+public:
+    // 0 means one thread per core
+    ThreadPool(const int threadCount = 0);
+    ~ThreadPool();
+
+    int threadCount() const { return m_threads.size(); }
+
+    void submit(function<void()> task);
+
+    // Blocks until everything submitted so far has finished
+    void wait();
+
+private:
+    struct Worker {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    void run(const size_t index);
+    bool takeTask(const size_t index, function<void()> *task);
+
+    vector<unique_ptr<Worker>> m_workers;
+    vector<thread> m_threads;
+
+    mutex m_mutex;
+    condition_variable m_wake;
+    condition_variable m_done;
+    int m_queued = 0; // submitted, not picked up yet
+    int m_pending = 0; // submitted, not finished yet
+    bool m_quit = false;
+
+    atomic<size_t> m_nextWorker;
+};
+
+#endif // THREADPOOL_H
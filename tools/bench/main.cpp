@@ -0,0 +1,537 @@
+#include "world.h"
+#include "player.h"
+#include "commandparser.h"
+#include "snapshot.h"
+#include "visibility.h"
+
+#include <SimpleJSON/json.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Keeps the compiler from optimizing away the benchmarked work
+static volatile int s_sink;
+
+// Fixed seed, reset for every benchmark, so every run benchmarks the same
+// maps and inputs even when only some of them are run
+static const uint32_t s_seed = 1337;
+static Random s_random(s_seed);
+
+struct Result {
+    std::string name;
+    double nanoseconds;
+};
+static std::vector<Result> s_results;
+
+static double measure(const std::function<void()> &function, const int iterations)
+{
+    function(); // warm up
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i=0; i<iterations; i++) {
+        function();
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+static void report(const std::string &name, const double nanoseconds)
+{
+    std::cout << name << ": " << nanoseconds << " ns/op" << std::endl;
+    s_results.push_back({ name, nanoseconds });
+}
+
+static std::vector<Rect> randomRectangles(const Vec2 &size, const int count)
+{
+    std::vector<Rect> rectangles;
+    for (int i=0; i<count; i++) {
+        const int rectWidth = s_random.bounded(200) + 20;
+        const int rectHeight = s_random.bounded(200) + 20;
+        rectangles.push_back(Rect::fromXywh(s_random.bounded(int(size.x - rectWidth)), s_random.bounded(int(size.y - rectHeight)), rectWidth, rectHeight));
+    }
+    return rectangles;
+}
+
+static std::vector<Vec2> randomPoints(const Vec2 &size, const int count)
+{
+    std::vector<Vec2> points;
+    for (int i=0; i<count; i++) {
+        points.push_back(Vec2(s_random.bounded(int(size.x)), s_random.bounded(int(size.y))));
+    }
+    return points;
+}
+
+// What World::isInside() and getPlayerAt() used to do
+static bool linearIsInside(const World &world, const Vec2 &position)
+{
+    for (const Rect &rectangle : world.rectangles()) {
+        if (rectangle.contains(position)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static shared_ptr<Player> linearGetPlayerAt(const World &world, const Vec2 &position)
+{
+    for (const shared_ptr<Player> &player : world.allPlayers()) {
+        if (player->isAlive() && player->geometry().contains(position)) {
+            return player;
+        }
+    }
+    return nullptr;
+}
+
+static void benchSpatialQueries()
+{
+    const Vec2 size(1920, 1080);
+    const std::vector<Vec2> bullets = randomPoints(size, 1000);
+
+    for (const int rectCount : { 5, 50, 500 }) {
+        World world(size, s_seed);
+        world.build();
+        world.setRectangles(randomRectangles(size, rectCount));
+
+        const std::string suffix = " (" + std::to_string(rectCount) + " rects, " + std::to_string(bullets.size()) + " bullets)";
+
+        report("isInside linear" + suffix, measure([&]() {
+            int inside = 0;
+            for (const Vec2 &bullet : bullets) {
+                inside += linearIsInside(world, bullet);
+            }
+            s_sink = inside;
+        }, 200));
+
+        report("isInside grid" + suffix, measure([&]() {
+            int inside = 0;
+            for (const Vec2 &bullet : bullets) {
+                inside += world.isInside(bullet);
+            }
+            s_sink = inside;
+        }, 200));
+
+        report("getPlayerAt linear" + suffix, measure([&]() {
+            int hits = 0;
+            for (const Vec2 &bullet : bullets) {
+                hits += linearGetPlayerAt(world, bullet) != nullptr;
+            }
+            s_sink = hits;
+        }, 200));
+
+        report("getPlayerAt grid" + suffix, measure([&]() {
+            int hits = 0;
+            for (const Vec2 &bullet : bullets) {
+                hits += world.getPlayerAt(bullet) != nullptr;
+            }
+            s_sink = hits;
+        }, 200));
+    }
+}
+
+// Also checks that all the kernels give bit-identical results to the scalar one
+static bool benchRayKernels()
+{
+    const Vec2 size(1920, 1080);
+    bool identical = true;
+
+    std::vector<Vec2> origins = randomPoints(size, 1000);
+    std::vector<Vec2> directions;
+    for (size_t i=0; i<origins.size(); i++) {
+        const float angle = s_random.bounded(10000) / 10000.f * 2 * M_PI;
+        directions.push_back(Vec2(cos(angle), sin(angle)));
+    }
+
+    std::vector<SegmentBuffer::Kernel> kernels = { SegmentBuffer::Scalar };
+    if (SegmentBuffer::bestKernel() >= SegmentBuffer::SSE2) {
+        kernels.push_back(SegmentBuffer::SSE2);
+    }
+    if (SegmentBuffer::bestKernel() >= SegmentBuffer::AVX2) {
+        kernels.push_back(SegmentBuffer::AVX2);
+    }
+
+    for (const int rectCount : { 5, 50, 500 }) {
+        World world(size, s_seed);
+        world.build();
+        world.setRectangles(randomRectangles(size, rectCount));
+        const SegmentBuffer &segments = world.segmentBuffer();
+
+        const std::string suffix = " (" + std::to_string(segments.size()) + " segments, " + std::to_string(origins.size()) + " rays)";
+
+        for (const SegmentBuffer::Kernel kernel : kernels) {
+            report(std::string("ray nearest ") + SegmentBuffer::kernelName(kernel) + suffix, measure([&]() {
+                int hits = 0;
+                for (size_t i=0; i<origins.size(); i++) {
+                    int index;
+                    segments.nearest(origins[i], directions[i], &index, kernel);
+                    hits += index;
+                }
+                s_sink = hits;
+            }, 100));
+
+            for (size_t i=0; i<origins.size(); i++) {
+                int scalarIndex, index;
+                const float scalar = segments.nearest(origins[i], directions[i], &scalarIndex, SegmentBuffer::Scalar);
+                const float distance = segments.nearest(origins[i], directions[i], &index, kernel);
+                if (index != scalarIndex || memcmp(&scalar, &distance, sizeof(float)) != 0) {
+                    std::cerr << SegmentBuffer::kernelName(kernel) << " differs from scalar: "
+                              << distance << " (" << index << ") vs " << scalar << " (" << scalarIndex << ")" << std::endl;
+                    identical = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    return identical;
+}
+
+// What Player::updateVisibility() does when the player has moved
+static void benchVisibility()
+{
+    const Vec2 size(1920, 1080);
+    const std::vector<Vec2> centers = randomPoints(size, 100);
+
+    for (const int rectCount : { 5, 50, 500 }) {
+        World world(size, s_seed);
+        world.build();
+        world.setRectangles(randomRectangles(size, rectCount));
+
+        std::vector<Vec2> polygon;
+        report("visibility (" + std::to_string(rectCount) + " rects)", measure([&]() {
+            size_t points = 0;
+            for (const Vec2 &center : centers) {
+                computeVisibility(center, world.segmentBuffer(), world.segmentCrossings(), &polygon);
+                points += polygon.size();
+            }
+            s_sink = points;
+        }, 20) / centers.size());
+    }
+}
+
+// The per-tick update encoding, the way it was done with serializeState()
+// and the shared snapshot it is done with now
+static void benchEncoding()
+{
+    const Vec2 size(1920, 1080);
+
+    for (const int playerCount : { 3, 32, 128 }) {
+        World world(size, s_seed);
+        world.build(playerCount);
+        world.setRunning(true);
+
+        // Some bullets in the air
+        Command command;
+        for (const shared_ptr<Player> &player : world.allPlayers()) {
+            command.type = Command::PointAt;
+            command.x = s_random.bounded(int(size.x));
+            command.y = s_random.bounded(int(size.y));
+            player->queueCommand(command);
+            command.type = Command::Fire;
+            player->queueCommand(command);
+        }
+        world.tick();
+
+        const std::string suffix = " (" + std::to_string(playerCount) + " players)";
+
+        report("encode serializeState" + suffix, measure([&]() {
+            size_t bytes = 0;
+            for (const shared_ptr<Player> &player : world.allPlayers()) {
+                json::JSON state;
+                state["type"] = "update";
+                state["you"] = player->serializeState();
+                json::JSON others = json::Array();
+                for (const shared_ptr<Player> &other : world.allPlayers()) {
+                    if (other != player) {
+                        others.append(other->serializeState());
+                    }
+                }
+                state["world"]["others"] = others;
+                bytes += state.dump(1, "", "").size();
+            }
+            s_sink = bytes;
+        }, 20));
+
+        // The delta is against the tick before, with everyone having moved
+        const shared_ptr<const Snapshot> base = make_shared<const Snapshot>(world);
+        for (const shared_ptr<Player> &player : world.allPlayers()) {
+            command.type = Command::Forward;
+            player->queueCommand(command);
+        }
+        world.tick();
+
+        struct Encoding {
+            const char *name;
+            protocol::Protocol protocol;
+            const Snapshot *base;
+        };
+        const Encoding encodings[] = {
+            { "text", protocol::Text, nullptr },
+            { "binary", protocol::Binary, nullptr },
+            { "delta keyframe", protocol::Delta, nullptr },
+            { "delta", protocol::Delta, base.get() },
+        };
+        for (const Encoding &encoding : encodings) {
+            report(std::string("encode snapshot ") + encoding.name + suffix, measure([&]() {
+                const shared_ptr<const Snapshot> snapshot = make_shared<const Snapshot>(world);
+                size_t bytes = 0;
+                std::vector<char> buffer;
+                for (size_t i=0; i<world.allPlayers().size(); i++) {
+                    buffer.clear();
+                    UpdateMessage(snapshot, i, encoding.protocol, encoding.base).copyTo(&buffer);
+                    bytes += buffer.size();
+                }
+                s_sink = bytes;
+            }, 20));
+        }
+    }
+}
+
+// What Player::onTcpMessage() and handleCommand() used to do for each line
+static int legacyParseLine(const std::string &line)
+{
+    std::vector<std::string> arguments;
+    std::istringstream stream(line);
+    std::string argument;
+    std::string command;
+    while (std::getline(stream, argument, ' ')) {
+        if (command.empty()) {
+            command = argument;
+        } else {
+            arguments.push_back(argument);
+        }
+    }
+
+    if (command == "NAME") {
+        return arguments.size();
+    } else if (command == "POINT_AT") {
+        if (arguments.size() != 2) {
+            return 0;
+        }
+        return int(std::stof(arguments[0]) + std::stof(arguments[1]));
+    } else if (command == "FIRE") {
+        return 1;
+    } else if (command == "STRAFE_LEFT") {
+        return 2;
+    } else if (command == "STRAFE_RIGHT") {
+        return 3;
+    } else if (command == "FORWARD") {
+        return 4;
+    } else if (command == "BACKWARD") {
+        return 5;
+    }
+    return 0;
+}
+
+static void benchCommandParsing()
+{
+    const char *fixed[] = { "FIRE", "FORWARD", "BACKWARD", "STRAFE_LEFT", "STRAFE_RIGHT", "NAME bot" };
+
+    std::string stream;
+    int commandCount = 0;
+    for (int i=0; i<10000; i++) {
+        if (i % 2 == 0) {
+            stream += "POINT_AT " + std::to_string(s_random.bounded(1920)) + "." + std::to_string(s_random.bounded(100)) + " " + std::to_string(s_random.bounded(1080)) + "\n";
+        } else {
+            stream += std::string(fixed[s_random.bounded(6)]) + "\n";
+        }
+        commandCount++;
+    }
+
+    // Delivered the way tacopie does it, in reads of up to 1024 bytes
+    const size_t readSize = 1024;
+
+    const std::string suffix = " (" + std::to_string(commandCount) + " commands)";
+
+    const double legacy = measure([&]() {
+        std::string buffer;
+        int sum = 0;
+        for (size_t position=0; position<stream.size(); position+=readSize) {
+            buffer += stream.substr(position, readSize);
+            std::string::size_type start = 0;
+            std::string::size_type newline;
+            while ((newline = buffer.find('\n', start)) != std::string::npos) {
+                sum += legacyParseLine(buffer.substr(start, newline - start));
+                start = newline + 1;
+            }
+            buffer.erase(0, start);
+        }
+        s_sink = sum;
+    }, 20);
+    report("command parsing legacy" + suffix, legacy);
+    std::cout << "  " << commandCount / legacy * 1000 << " M commands/s" << std::endl;
+
+    const double streaming = measure([&]() {
+        CommandParser parser;
+        int sum = 0;
+        for (size_t position=0; position<stream.size(); position+=readSize) {
+            parser.feed(stream.data() + position, std::min(readSize, stream.size() - position), [&](const Command &command) {
+                sum += command.type + int(command.x + command.y);
+            });
+        }
+        s_sink = sum;
+    }, 20);
+    report("command parsing streaming" + suffix, streaming);
+    std::cout << "  " << commandCount / streaming * 1000 << " M commands/s" << std::endl;
+}
+
+// Whole ticks with every player aiming, walking and sometimes firing. When a
+// match is over the world is built again, outside the timing, so every
+// iteration that is measured is a tick that ran.
+static void benchScaling()
+{
+    const Vec2 size(1920, 1080);
+    const int iterations = 100;
+
+    for (const int playerCount : { 3, 32, 128, 512 }) {
+        std::unique_ptr<World> world;
+        int matches = 0;
+        Command command;
+        std::chrono::duration<double, std::nano> elapsed(0);
+
+        // The first one is to warm up
+        for (int i=-1; i<iterations; i++) {
+            if (!world || !world->isRunning()) {
+                world = std::make_unique<World>(size, s_seed);
+                world->build(playerCount);
+                world->setRunning(true);
+                matches++;
+            }
+
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (const shared_ptr<Player> &player : world->allPlayers()) {
+                command.type = Command::PointAt;
+                command.x = s_random.bounded(int(size.x));
+                command.y = s_random.bounded(int(size.y));
+                player->queueCommand(command);
+
+                command.type = (s_random.bounded(200) == 0) ? Command::Fire : Command::Forward;
+                player->queueCommand(command);
+            }
+            world->tick();
+            if (i >= 0) {
+                elapsed += std::chrono::steady_clock::now() - start;
+            }
+        }
+
+        report("tick (" + std::to_string(playerCount) + " players)", elapsed.count() / iterations);
+        std::cout << "  matches played: " << matches << std::endl;
+    }
+}
+
+static bool writeResults(const std::string &path)
+{
+    json::JSON results = json::Object();
+    for (const Result &result : s_results) {
+        results[result.name] = result.nanoseconds;
+    }
+
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Unable to write " << path << std::endl;
+        return false;
+    }
+    file << results.dump() << std::endl;
+    return true;
+}
+
+// Everything more than threshold slower than the baseline is a regression
+static bool compareResults(const std::string &path, const double threshold)
+{
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Unable to read " << path << std::endl;
+        return false;
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    json::JSON baseline = json::JSON::Load(contents.str());
+
+    int regressions = 0;
+    std::cout << std::endl << "Compared to " << path << ":" << std::endl;
+    for (const Result &result : s_results) {
+        if (!baseline.hasKey(result.name)) {
+            std::cout << result.name << ": new" << std::endl;
+            continue;
+        }
+        const double before = baseline[result.name].ToFloat();
+        const double change = before > 0 ? result.nanoseconds / before - 1 : 0;
+        const bool regressed = change > threshold;
+        std::cout << result.name << ": " << std::showpos << std::lround(change * 100) << std::noshowpos << "%"
+                  << (regressed ? " REGRESSION" : "") << std::endl;
+        regressions += regressed;
+    }
+
+    if (regressions) {
+        std::cerr << regressions << " benchmarks regressed by more than " << threshold * 100 << "%" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void printUsage(const char *name)
+{
+    std::cerr << "Usage: " << name << " [options]" << std::endl;
+    std::cerr << "  --filter <text>      Only run the benchmark groups with this in their name" << std::endl;
+    std::cerr << "  --json <file>        Write the results there, to use as a baseline" << std::endl;
+    std::cerr << "  --compare <file>     Compare to a baseline, fails on regressions" << std::endl;
+    std::cerr << "  --threshold <pct>    How much slower counts as a regression (default 10)" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string filter;
+    std::string jsonPath;
+    std::string baselinePath;
+    double threshold = 0.1;
+
+    for (int i=1; i<argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--compare" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (arg == "--threshold" && i + 1 < argc) {
+            threshold = atof(argv[++i]) / 100;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    const std::vector<std::pair<std::string, std::function<bool()>>> groups = {
+        { "spatial", []() { benchSpatialQueries(); return true; } },
+        { "visibility", []() { benchVisibility(); return true; } },
+        { "encoding", []() { benchEncoding(); return true; } },
+        { "parsing", []() { benchCommandParsing(); return true; } },
+        { "tick", []() { benchScaling(); return true; } },
+        { "rays", benchRayKernels },
+    };
+
+    bool ok = true;
+    for (const std::pair<std::string, std::function<bool()>> &group : groups) {
+        if (group.first.find(filter) == std::string::npos) {
+            continue;
+        }
+        s_random.setSeed(s_seed);
+        ok = group.second() && ok;
+    }
+
+    if (!jsonPath.empty()) {
+        ok = writeResults(jsonPath) && ok;
+    }
+    if (!baselinePath.empty()) {
+        ok = compareResults(baselinePath, threshold) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,497 @@
+#include "world.h"
+#include "profiler.h"
+#include "protocol.h"
+#include "random.h"
+
+#include <SimpleJSON/json.hpp>
+#include <tacopie/network/tcp_client.hpp>
+#include <tacopie/utils/error.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+
+// Connects lots of bots to a server and measures how it holds up: how evenly
+// the updates arrive, how long a command takes to show up in them and how
+// much each bot receives. With --ramp the connections are added in steps, so
+// the report shows where the server stops keeping up.
+//
+// Start the server with room for them, e.g. --max-players 1000 --no-wait.
+
+static std::atomic<bool> s_quit(false);
+
+static void sigintHandler(int)
+{
+    s_quit = true;
+}
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 1337;
+    int connections = 100;
+    int ramp = 0;
+    int seconds = 10;
+    double rate = 10;
+    int firePercent = 10;
+    bool text = false;
+    uint32_t seed = 1;
+    std::string jsonPath;
+};
+
+// What everyone saw while a certain number of bots were connected
+struct Step {
+    int connections = 0;
+    double seconds = 0;
+    long firstTick = -1;
+    long lastTick = -1;
+
+    Histogram intervals;
+    Histogram jitter;
+    Histogram latencies;
+    std::atomic<uint64_t> updates { 0 };
+    std::atomic<uint64_t> bytes { 0 };
+    std::atomic<uint64_t> lostProbes { 0 };
+};
+
+static std::vector<std::unique_ptr<Step>> s_steps;
+// -1 while connecting, that is not measured
+static std::atomic<int> s_currentStep(-1);
+static std::atomic<long> s_lastTick(-1);
+
+// One simulated bot. Reads are handled on the tacopie threads, one at a time
+// per client, commands are sent from the main thread.
+struct Client {
+    int index = 0;
+    std::shared_ptr<tacopie::tcp_client> connection;
+    std::atomic<bool> connected { false };
+    Random random;
+
+    // Only touched by the read callbacks
+    std::vector<char> buffer;
+    bool binarySeen = false;
+    Clock::time_point lastUpdate;
+
+    // Sent POINT_AT that hasn't shown up in an update yet
+    std::mutex probeMutex;
+    bool probing = false;
+    float probeX = 0;
+    float probeY = 0;
+    Clock::time_point probeSent;
+
+    Clock::time_point nextCommand;
+};
+
+static void recordTick(const long tick)
+{
+    long previous = s_lastTick.load();
+    while (tick > previous && !s_lastTick.compare_exchange_weak(previous, tick)) {
+    }
+}
+
+// What an update said about us
+static void handleUpdate(Client *client, const bool alive, const float pointingX, const float pointingY)
+{
+    const Clock::time_point now = Clock::now();
+    const int stepIndex = s_currentStep;
+    if (stepIndex < 0) {
+        client->lastUpdate = now;
+        return;
+    }
+    Step *step = s_steps[stepIndex].get();
+
+    step->updates++;
+    if (client->lastUpdate != Clock::time_point()) {
+        const Clock::duration interval = now - client->lastUpdate;
+        const Clock::duration expected = World::tickInterval;
+        step->intervals.record(std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count());
+        step->jitter.record(std::chrono::duration_cast<std::chrono::nanoseconds>(interval > expected ? interval - expected : expected - interval).count());
+    }
+    client->lastUpdate = now;
+
+    std::lock_guard<std::mutex> lock(client->probeMutex);
+    if (!client->probing) {
+        return;
+    }
+    if (std::fabs(pointingX - client->probeX) < 0.5f && std::fabs(pointingY - client->probeY) < 0.5f) {
+        step->latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - client->probeSent).count());
+        client->probing = false;
+    } else if (!alive || now - client->probeSent > std::chrono::seconds(5)) {
+        // Dead players don't turn, and nothing should take that long
+        step->lostProbes++;
+        client->probing = false;
+    }
+}
+
+// The text protocol puts us first, so only that part needs looking at
+static bool parseTextUpdate(Client *client, const std::string &line)
+{
+    const size_t you = line.find("\"you\":");
+    const size_t pointingX = line.find("\"pointing_at_x\":", you);
+    const size_t pointingY = line.find("\"pointing_at_y\":", you);
+    if (you == std::string::npos || pointingX == std::string::npos || pointingY == std::string::npos) {
+        return false;
+    }
+    const bool alive = line.compare(you + 6, 13, "{\"alive\":true") == 0;
+    handleUpdate(client, alive, strtof(line.c_str() + pointingX + 16, nullptr), strtof(line.c_str() + pointingY + 16, nullptr));
+    return true;
+}
+
+static void parseBuffer(Client *client, const bool text)
+{
+    std::vector<char> &buffer = client->buffer;
+    size_t position = 0;
+
+    while (position < buffer.size()) {
+        const char *data = buffer.data() + position;
+        const size_t available = buffer.size() - position;
+
+        // Until PROTOCOL BINARY is through we get text lines like everyone
+        if (text || (!client->binarySeen && available >= 8 && memcmp(data, "{\"type\":", 8) == 0)) {
+            const char *end = static_cast<const char*>(memchr(data, '\n', available));
+            if (!end) {
+                break;
+            }
+            const std::string line(data, end);
+            if (line.compare(0, 16, "{\"type\":\"update\"") == 0) {
+                parseTextUpdate(client, line);
+            }
+            position += end - data + 1;
+            continue;
+        }
+        if (available < 8) {
+            break;
+        }
+
+        protocol::Reader reader(data, available);
+        const uint32_t length = reader.u32();
+        if (available < 4 + size_t(length)) {
+            break;
+        }
+        client->binarySeen = true;
+
+        if (reader.u8() == protocol::FrameUpdate) {
+            const long tick = reader.u32();
+            reader.u32(); // seed
+            reader.i32(); // id
+            reader.f32(); // x
+            reader.f32(); // y
+            const float pointingX = reader.f32();
+            const float pointingY = reader.f32();
+            reader.f32(); // rotation
+            const bool alive = reader.u8();
+            if (reader.ok()) {
+                recordTick(tick);
+                handleUpdate(client, alive, pointingX, pointingY);
+            }
+        }
+        position += 4 + length;
+    }
+
+    buffer.erase(buffer.begin(), buffer.begin() + position);
+}
+
+static void startReading(Client *client, const bool text)
+{
+    tacopie::tcp_client::read_request request;
+    request.size = 4096;
+    request.async_read_callback = [client, text](tacopie::tcp_client::read_result &result) {
+        if (!result.success) {
+            client->connected = false;
+            return;
+        }
+        const int stepIndex = s_currentStep;
+        if (stepIndex >= 0) {
+            s_steps[stepIndex]->bytes += result.buffer.size();
+        }
+        client->buffer.insert(client->buffer.end(), result.buffer.begin(), result.buffer.end());
+        parseBuffer(client, text);
+        startReading(client, text);
+    };
+    client->connection->async_read(request);
+}
+
+static void send(Client *client, const std::string &commands)
+{
+    if (!client->connected) {
+        return;
+    }
+    tacopie::tcp_client::write_request request;
+    request.buffer.assign(commands.begin(), commands.end());
+    request.async_write_callback = [](tacopie::tcp_client::write_result &) {};
+    try {
+        client->connection->async_write(request);
+    } catch (const tacopie::tacopie_error &) {
+        client->connected = false;
+    }
+}
+
+static bool connectClient(Client *client, const Options &options)
+{
+    client->connection = std::make_shared<tacopie::tcp_client>();
+    try {
+        client->connection->connect(options.host, options.port, 1000);
+    } catch (const tacopie::tacopie_error &error) {
+        std::cerr << "Connection " << client->index << " failed: " << error.what() << std::endl;
+        return false;
+    }
+    client->connected = true;
+    client->random.setSeed(options.seed + client->index);
+
+    startReading(client, options.text);
+
+    std::string hello = "NAME loadgen" + std::to_string(client->index) + "\n";
+    if (!options.text) {
+        hello += "PROTOCOL BINARY\n";
+    }
+    send(client, hello);
+
+    // Spread out, so they don't all send at once
+    client->nextCommand = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(client->random.uniform() / options.rate));
+    return true;
+}
+
+// The mix a simple bot sends: mostly moving around and aiming, some firing
+static std::string nextCommand(Client *client, const Options &options)
+{
+    Random &random = client->random;
+    const uint32_t roll = random.bounded(100);
+
+    if (roll < uint32_t(options.firePercent)) {
+        return "FIRE\n";
+    }
+
+    if (roll < uint32_t(options.firePercent) + (100 - options.firePercent) / 3) {
+        std::lock_guard<std::mutex> lock(client->probeMutex);
+        // Another POINT_AT would hide when the outstanding one got applied
+        if (!client->probing) {
+            client->probing = true;
+            client->probeX = random.bounded(1280);
+            client->probeY = random.bounded(720);
+            client->probeSent = Clock::now();
+            return "POINT_AT " + std::to_string(int(client->probeX)) + " " + std::to_string(int(client->probeY)) + "\n";
+        }
+    }
+
+    static const char *movements[] = { "FORWARD\n", "BACKWARD\n", "STRAFE_LEFT\n", "STRAFE_RIGHT\n" };
+    return movements[random.bounded(4)];
+}
+
+static void sendCommands(const std::vector<std::unique_ptr<Client>> &clients, const Options &options)
+{
+    const Clock::time_point now = Clock::now();
+    const Clock::duration interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / options.rate));
+
+    for (const std::unique_ptr<Client> &client : clients) {
+        std::string commands;
+        while (client->nextCommand <= now) {
+            commands += nextCommand(client.get(), options);
+            client->nextCommand += interval;
+        }
+        if (!commands.empty()) {
+            send(client.get(), commands);
+        }
+    }
+}
+
+static double toMilliseconds(const uint64_t nanoseconds)
+{
+    return nanoseconds / 1000000.;
+}
+
+static double tickRate(const Step &step)
+{
+    if (step.firstTick < 0 || step.lastTick <= step.firstTick || step.seconds <= 0) {
+        return 0;
+    }
+    return (step.lastTick - step.firstTick) / step.seconds;
+}
+
+static void printStep(const Step &step, const bool text)
+{
+    const double perClient = step.connections * step.seconds;
+    std::cout << step.connections << " connections:" << std::endl;
+    if (text) {
+        std::cout << "  updates/s per client " << (perClient > 0 ? step.updates / perClient : 0) << std::endl;
+    } else {
+        std::cout << "  server ticks/s       " << tickRate(step) << std::endl;
+    }
+    std::cout << "  update interval      p50 " << toMilliseconds(step.intervals.percentile(50)) << " ms, p99 "
+              << toMilliseconds(step.intervals.percentile(99)) << " ms, max " << toMilliseconds(step.intervals.max()) << " ms" << std::endl;
+    std::cout << "  jitter               p50 " << toMilliseconds(step.jitter.percentile(50)) << " ms, p99 "
+              << toMilliseconds(step.jitter.percentile(99)) << " ms" << std::endl;
+    std::cout << "  command latency      p50 " << toMilliseconds(step.latencies.percentile(50)) << " ms, p99 "
+              << toMilliseconds(step.latencies.percentile(99)) << " ms";
+    if (step.lostProbes) {
+        std::cout << ", " << step.lostProbes << " never applied";
+    }
+    std::cout << std::endl;
+    std::cout << "  received per client  " << (perClient > 0 ? step.bytes / perClient / 1024 : 0) << " kB/s" << std::endl;
+}
+
+static bool writeReport(const std::string &path)
+{
+    json::JSON report = json::Array();
+    for (const std::unique_ptr<Step> &step : s_steps) {
+        if (!step->connections) {
+            continue;
+        }
+        json::JSON entry = json::Object();
+        const double perClient = step->connections * step->seconds;
+        entry["connections"] = step->connections;
+        entry["ticksPerSecond"] = tickRate(*step);
+        entry["updatesPerSecond"] = perClient > 0 ? step->updates / perClient : 0;
+        entry["intervalP50"] = toMilliseconds(step->intervals.percentile(50));
+        entry["intervalP99"] = toMilliseconds(step->intervals.percentile(99));
+        entry["intervalMax"] = toMilliseconds(step->intervals.max());
+        entry["jitterP50"] = toMilliseconds(step->jitter.percentile(50));
+        entry["jitterP99"] = toMilliseconds(step->jitter.percentile(99));
+        entry["latencyP50"] = toMilliseconds(step->latencies.percentile(50));
+        entry["latencyP99"] = toMilliseconds(step->latencies.percentile(99));
+        entry["lostCommands"] = long(step->lostProbes);
+        entry["bytesPerSecond"] = perClient > 0 ? step->bytes / perClient : 0;
+        report.append(entry);
+    }
+
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Unable to write " << path << std::endl;
+        return false;
+    }
+    file << report.dump() << std::endl;
+    return true;
+}
+
+static void printUsage(const char *name)
+{
+    std::cerr << "Usage: " << name << " [options]" << std::endl;
+    std::cerr << "  --host <host>      Server to connect to (default 127.0.0.1)" << std::endl;
+    std::cerr << "  --port <port>      Port to connect to (default 1337)" << std::endl;
+    std::cerr << "  --connections <n>  Bots to connect (default 100)" << std::endl;
+    std::cerr << "  --ramp <n>         Connect this many more every step instead of all at once" << std::endl;
+    std::cerr << "  --seconds <n>      How long each step measures (default 10)" << std::endl;
+    std::cerr << "  --rate <n>         Commands per second per bot (default 10)" << std::endl;
+    std::cerr << "  --fire <percent>   How many of the commands are FIRE (default 10)" << std::endl;
+    std::cerr << "  --text             Use the text protocol instead of binary" << std::endl;
+    std::cerr << "  --seed <n>         Seed for the commands (default 1)" << std::endl;
+    std::cerr << "  --json <file>      Also write the report there" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+
+    for (int i=1; i<argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            options.port = atoi(argv[++i]);
+        } else if (arg == "--connections" && i + 1 < argc) {
+            options.connections = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--ramp" && i + 1 < argc) {
+            options.ramp = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            options.seconds = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--rate" && i + 1 < argc) {
+            options.rate = std::max(0.1, atof(argv[++i]));
+        } else if (arg == "--fire" && i + 1 < argc) {
+            options.firePercent = std::min(100, std::max(0, atoi(argv[++i])));
+        } else if (arg == "--text") {
+            options.text = true;
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.jsonPath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    signal(SIGINT, sigintHandler);
+
+    const int perStep = options.ramp ? options.ramp : options.connections;
+    const int stepCount = (options.connections + perStep - 1) / perStep;
+    for (int i=0; i<stepCount; i++) {
+        s_steps.push_back(std::make_unique<Step>());
+    }
+
+    std::vector<std::unique_ptr<Client>> clients;
+    const double nominalTickRate = 1 / std::chrono::duration<double>(World::tickInterval).count();
+    int degradedAt = 0;
+
+    for (int stepIndex=0; stepIndex<stepCount && !s_quit; stepIndex++) {
+        const int target = std::min(options.connections, perStep * (stepIndex + 1));
+        while (int(clients.size()) < target && !s_quit) {
+            std::unique_ptr<Client> client = std::make_unique<Client>();
+            client->index = clients.size();
+            if (!connectClient(client.get(), options)) {
+                break;
+            }
+            clients.push_back(std::move(client));
+        }
+        if (clients.empty()) {
+            std::cerr << "Unable to connect to " << options.host << ":" << options.port << std::endl;
+            return 1;
+        }
+
+        // Measured from here on, so connecting doesn't count
+        s_currentStep = stepIndex;
+        Step &step = *s_steps[stepIndex];
+        const Clock::time_point start = Clock::now();
+        step.firstTick = s_lastTick;
+
+        const Clock::time_point end = start + std::chrono::seconds(options.seconds);
+        while (Clock::now() < end && !s_quit) {
+            sendCommands(clients, options);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        int connected = 0;
+        for (const std::unique_ptr<Client> &client : clients) {
+            connected += client->connected;
+        }
+        step.connections = connected;
+        step.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        step.lastTick = s_lastTick;
+
+        s_currentStep = -1;
+
+        printStep(step, options.text);
+
+        if (!options.text && !degradedAt && tickRate(step) < nominalTickRate * 0.95) {
+            degradedAt = connected;
+        }
+        if (int(clients.size()) < target) {
+            std::cerr << "Stopping, the server didn't take more than " << clients.size() << " connections" << std::endl;
+            break;
+        }
+    }
+
+    for (const std::unique_ptr<Client> &client : clients) {
+        client->connection->disconnect(true);
+    }
+
+    if (degradedAt) {
+        std::cout << "The tick rate fell below " << nominalTickRate * 0.95 << "/s at " << degradedAt << " connections" << std::endl;
+    }
+
+    if (!options.jsonPath.empty() && !writeReport(options.jsonPath)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "world.h"
+#include "player.h"
+#include "replay.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Plays back recorded games headless, as fast as they simulate, and prints
+// what happened in them
+
+struct PlayerStats {
+    int shots = 0;
+    long diedAt = -1;
+};
+
+static void printState(World *world)
+{
+    std::cout << "  tick " << world->tickCount() << std::endl;
+    for (const shared_ptr<Player> &player : world->allPlayers()) {
+        std::cout << "  " << player->name() << ": " << player->position().x << "," << player->position().y
+                  << (player->isAlive() ? "" : " dead") << ", " << player->bullets().size() << " bullets" << std::endl;
+    }
+}
+
+static bool replayFile(const std::string &path, const long seekTick, const bool verify)
+{
+    Replay replay;
+    if (!replay.open(path)) {
+        std::cerr << path << ": " << replay.errorString() << std::endl;
+        return false;
+    }
+
+    if (seekTick >= 0) {
+        if (!replay.seek(seekTick)) {
+            std::cerr << path << ": " << replay.errorString() << std::endl;
+            return false;
+        }
+        std::cout << path << ":" << std::endl;
+        printState(replay.world());
+        return true;
+    }
+
+    replay.setVerify(verify);
+
+    std::vector<PlayerStats> stats;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    while (replay.step()) {
+        World *world = replay.world();
+        stats.resize(world->allPlayers().size());
+
+        for (const pair<int, Command> &command : replay.lastCommands()) {
+            if (command.second.type == Command::Fire) {
+                stats[command.first].shots++;
+            }
+        }
+        for (size_t i=0; i<stats.size(); i++) {
+            if (stats[i].diedAt < 0 && !world->allPlayers()[i]->isAlive()) {
+                stats[i].diedAt = world->tickCount();
+            }
+        }
+    }
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // step() also stops at a corrupt record, which leaves an error
+    if (!replay.errorString().empty()) {
+        std::cerr << path << ": " << replay.errorString() << std::endl;
+        return false;
+    }
+
+    World *world = replay.world();
+    const long ticks = world->tickCount() - replay.firstTick();
+    std::cout << path << ": " << ticks << " ticks";
+    if (world->isGameOver()) {
+        int alive = -1;
+        for (size_t i=0; i<stats.size(); i++) {
+            if (world->allPlayers()[i]->isAlive()) {
+                alive = i;
+            }
+        }
+        std::cout << ", " << (alive >= 0 ? world->allPlayers()[alive]->name() + " won" : "draw");
+    }
+    std::cout << ", replayed at " << long(ticks / elapsed) << " ticks/s" << std::endl;
+
+    for (size_t i=0; i<stats.size(); i++) {
+        std::cout << "  " << world->allPlayers()[i]->name() << ": " << stats[i].shots << " shots, ";
+        if (stats[i].diedAt >= 0) {
+            std::cout << "died at tick " << stats[i].diedAt << std::endl;
+        } else {
+            std::cout << "survived" << std::endl;
+        }
+    }
+
+    if (replay.mismatches() > 0) {
+        std::cerr << path << ": " << replay.mismatches() << " keyframes differ from the recording" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void printUsage(const char *name)
+{
+    std::cerr << "Usage: " << name << " [options] <replay>..." << std::endl;
+    std::cerr << "  --seek <tick>      Print the state after this tick instead" << std::endl;
+    std::cerr << "  --verify           Check the replay against the recorded keyframes" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    long seekTick = -1;
+    bool verify = false;
+    std::vector<std::string> paths;
+
+    for (int i=1; i<argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--seek" && i + 1 < argc) {
+            seekTick = atol(argv[++i]);
+        } else if (arg == "--verify") {
+            verify = true;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    if (paths.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    bool ok = true;
+    for (const std::string &path : paths) {
+        ok = replayFile(path, seekTick, verify) && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,540 @@
+#include "world.h"
+#include "player.h"
+#include "threadpool.h"
+
+#include <tacopie/network/tcp_server.hpp>
+#include <tacopie/utils/error.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+}
+
+// Runs bots against each other without a window, several matches at a time.
+// Every bot command gets the host and port to connect to appended as
+// arguments, like "examples/rand0m.py 127.0.0.1 4000".
+//
+// The results are one record per line:
+//   bot <index> <command>
+//   match <round> <first bot> <second bot> <winner or -1> <how it ended> <ticks>
+//   rating <bot> <elo> <glicko> <glicko deviation> <points> <wins> <draws> <losses>
+
+static std::atomic<bool> s_quit(false);
+
+static void sigintHandler(int)
+{
+    s_quit = true;
+}
+
+struct Options {
+    std::vector<std::string> bots;
+    bool swiss = false;
+    int rounds = 0;
+    int games = 1;
+    int cores = 0;
+    int port = 4000;
+    long maxTicks = 3000;
+    uint32_t seed = 1;
+    bool fast = false;
+    Vec2 size = Vec2(1280, 720);
+    std::string output;
+    std::string recordDirectory;
+};
+
+struct Match {
+    int round = 0;
+    int bots[2] = { -1, -1 };
+
+    // Index into bots of the winner, -1 on a draw
+    int winner = -1;
+    long ticks = 0;
+    std::string reason;
+};
+
+struct Standing {
+    double rating = 1500;
+    // Glicko, the deviation shrinks as the bot plays and says how far off
+    // the rating may still be
+    double glicko = 1500;
+    double deviation = 350;
+    double points = 0;
+    int wins = 0;
+    int draws = 0;
+    int losses = 0;
+    bool hadBye = false;
+    std::vector<int> opponents;
+};
+
+// Ports handed out to the matches running at the moment
+class PortPool
+{
+public:
+    PortPool(const int first, const int count) {
+        for (int i=0; i<count; i++) {
+            m_free.push_back(first + i);
+        }
+    }
+
+    int take() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const int port = m_free.back();
+        m_free.pop_back();
+        return port;
+    }
+
+    void give(const int port) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(port);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<int> m_free;
+};
+
+// Everything past stderr is ours, the listening sockets and the other bots'
+// connections among them. Closed in the child instead of marking them close
+// on exec, since tacopie makes its sockets without it and other matches open
+// new ones on their own threads while we fork.
+static void closeInheritedDescriptors(const long maxDescriptor)
+{
+#ifdef __linux__
+    if (close_range(STDERR_FILENO + 1, ~0U, 0) == 0) {
+        return;
+    }
+#endif
+    for (long fd = STDERR_FILENO + 1; fd < maxDescriptor; fd++) {
+        close(fd);
+    }
+}
+
+static pid_t launchBot(const std::string &command, const int port)
+{
+    const std::string commandLine = command + " 127.0.0.1 " + std::to_string(port);
+    const long maxDescriptor = sysconf(_SC_OPEN_MAX);
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Failed to launch " << command << std::endl;
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Own process group, so the shell and whatever it started is killed together
+        setpgid(0, 0);
+
+        const int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0) {
+            dup2(devNull, STDOUT_FILENO);
+            close(devNull);
+        }
+        closeInheritedDescriptors(maxDescriptor);
+
+        execl("/bin/sh", "sh", "-c", commandLine.c_str(), nullptr);
+        _exit(127);
+    }
+
+    return pid;
+}
+
+static void stopBot(const pid_t pid)
+{
+    if (pid <= 0) {
+        return;
+    }
+    kill(-pid, SIGTERM);
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+// Same rules as the viewer and the server, World decides when it is over
+static void playMatch(const Options &options, Match *match, const int port, const uint32_t seed, const std::string &recordPath)
+{
+    World world(options.size, seed);
+    world.build(2);
+    world.setRunning(true);
+    if (!recordPath.empty()) {
+        world.startRecording(recordPath);
+    }
+
+    shared_ptr<Player> winner;
+    world.onGameOver = [&](shared_ptr<Player> player) {
+        winner = player;
+    };
+
+    tacopie::tcp_server server;
+    try {
+        server.start("127.0.0.1", port, [&](const shared_ptr<tcp_client> &client) -> bool {
+            return world.onNewClient(make_shared<TacopieConnection>(client));
+        });
+    } catch (const tacopie::tacopie_error &error) {
+        std::cerr << "error when listening on " << port << ": " << error.what() << std::endl;
+        match->reason = "error";
+        return;
+    }
+
+    // One at a time, so the first bot is always the first player
+    std::vector<pid_t> pids;
+    for (int i=0; i<2 && match->reason.empty(); i++) {
+        pids.push_back(launchBot(options.bots[match->bots[i]], port));
+
+        const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + 10s;
+        while (world.connectedCount() <= i && std::chrono::steady_clock::now() < deadline && !s_quit) {
+            std::this_thread::sleep_for(10ms);
+        }
+        if (world.connectedCount() <= i) {
+            std::cerr << "Bot did not connect: " << options.bots[match->bots[i]] << std::endl;
+            match->winner = match->bots[1 - i];
+            match->reason = "forfeit";
+        }
+    }
+
+    std::chrono::steady_clock::time_point nextTick = std::chrono::steady_clock::now();
+    while (match->reason.empty() && world.isRunning() && !s_quit) {
+        if (world.tickCount() >= options.maxTicks) {
+            match->reason = "timeout";
+            break;
+        }
+        if (!options.fast) {
+            std::this_thread::sleep_until(nextTick);
+            nextTick += World::tickInterval;
+        }
+        world.tick();
+    }
+
+    if (match->reason.empty()) {
+        if (!world.isGameOver()) {
+            match->reason = "aborted";
+        } else if (winner) {
+            match->winner = winner == world.allPlayers()[0] ? match->bots[0] : match->bots[1];
+            match->reason = "won";
+        } else {
+            match->reason = "draw";
+        }
+    }
+    match->ticks = world.tickCount();
+
+    for (const pid_t pid : pids) {
+        stopBot(pid);
+    }
+    for (const shared_ptr<Player> &player : world.allPlayers()) {
+        player->closeConnection();
+    }
+    server.stop(true, true);
+}
+
+static void playMatches(const Options &options, std::vector<Match> *matches, const size_t first, ThreadPool *pool, PortPool *ports)
+{
+    for (size_t i=first; i<matches->size(); i++) {
+        Match *match = &(*matches)[i];
+        const uint32_t seed = options.seed + i;
+        std::string recordPath;
+        if (!options.recordDirectory.empty()) {
+            recordPath = options.recordDirectory + "/match-" + std::to_string(i) + ".tgr";
+        }
+        pool->submit([&options, match, ports, seed, recordPath]() {
+            if (s_quit) {
+                return;
+            }
+            const int port = ports->take();
+            playMatch(options, match, port, seed, recordPath);
+            ports->give(port);
+
+            static std::mutex s_printMutex;
+            std::lock_guard<std::mutex> lock(s_printMutex);
+            std::cerr << "round " << match->round << ": " << match->bots[0] << " vs " << match->bots[1] << ": " << match->reason;
+            if (match->winner >= 0) {
+                std::cerr << ", " << match->winner << " won";
+            }
+            std::cerr << " after " << match->ticks << " ticks" << std::endl;
+        });
+    }
+    pool->wait();
+}
+
+// One match is one rating period, with no time passing in between
+static void updateGlicko(Standing *standing, const Standing &opponent, const double score)
+{
+    const double q = log(10) / 400;
+    const double g = 1 / sqrt(1 + 3 * q * q * opponent.deviation * opponent.deviation / (M_PI * M_PI));
+    const double expected = 1 / (1 + pow(10, -g * (standing->glicko - opponent.glicko) / 400));
+    const double dSquared = 1 / (q * q * g * g * expected * (1 - expected));
+    const double variance = 1 / (1 / (standing->deviation * standing->deviation) + 1 / dSquared);
+    standing->glicko += q * variance * g * (score - expected);
+    standing->deviation = sqrt(variance);
+}
+
+// Applied in the order the matches were scheduled, not the order they
+// finished in, so the ratings do not depend on timing
+static void updateStandings(const std::vector<Match> &matches, const size_t first, std::vector<Standing> *standings)
+{
+    const double k = 32;
+
+    for (size_t i=first; i<matches.size(); i++) {
+        const Match &match = matches[i];
+        if (match.reason.empty() || match.reason == "aborted" || match.reason == "error") {
+            continue;
+        }
+
+        Standing &a = (*standings)[match.bots[0]];
+        Standing &b = (*standings)[match.bots[1]];
+        a.opponents.push_back(match.bots[1]);
+        b.opponents.push_back(match.bots[0]);
+
+        double score = 0.5;
+        if (match.winner == match.bots[0]) {
+            score = 1;
+            a.wins++;
+            b.losses++;
+        } else if (match.winner == match.bots[1]) {
+            score = 0;
+            a.losses++;
+            b.wins++;
+        } else {
+            a.draws++;
+            b.draws++;
+        }
+        a.points += score;
+        b.points += 1 - score;
+
+        const double expected = 1 / (1 + pow(10, (b.rating - a.rating) / 400));
+        a.rating += k * (score - expected);
+        b.rating -= k * (score - expected);
+
+        const Standing before = a;
+        updateGlicko(&a, b, score);
+        updateGlicko(&b, before, 1 - score);
+    }
+}
+
+static std::vector<Match> roundRobin(const Options &options)
+{
+    std::vector<Match> matches;
+    for (int game=0; game<options.games; game++) {
+        for (size_t a=0; a<options.bots.size(); a++) {
+            for (size_t b=a+1; b<options.bots.size(); b++) {
+                Match match;
+                match.round = game;
+                // Switch who is first player every other game
+                match.bots[0] = game % 2 ? b : a;
+                match.bots[1] = game % 2 ? a : b;
+                matches.push_back(match);
+            }
+        }
+    }
+    return matches;
+}
+
+// Pairs bots with similar points that have not met yet, the one left over
+// with an odd count gets a bye worth a win
+static std::vector<Match> swissRound(const int round, std::vector<Standing> *standings)
+{
+    std::vector<int> order;
+    for (size_t i=0; i<standings->size(); i++) {
+        order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+        return (*standings)[a].points > (*standings)[b].points;
+    });
+
+    if (order.size() % 2) {
+        for (int i=order.size() - 1; i>=0; i--) {
+            Standing &standing = (*standings)[order[i]];
+            if (!standing.hadBye) {
+                standing.hadBye = true;
+                standing.points += 1;
+                standing.wins++;
+                order.erase(order.begin() + i);
+                break;
+            }
+        }
+    }
+
+    std::vector<Match> matches;
+    std::vector<bool> paired(order.size(), false);
+    for (size_t i=0; i<order.size(); i++) {
+        if (paired[i]) {
+            continue;
+        }
+        const std::vector<int> &opponents = (*standings)[order[i]].opponents;
+
+        // Closest in the standings that it has not played, or just the closest
+        size_t opponent = 0;
+        for (size_t j=i+1; j<order.size(); j++) {
+            if (paired[j]) {
+                continue;
+            }
+            if (!opponent) {
+                opponent = j;
+            }
+            if (std::find(opponents.begin(), opponents.end(), order[j]) == opponents.end()) {
+                opponent = j;
+                break;
+            }
+        }
+        if (!opponent) {
+            continue;
+        }
+
+        paired[i] = paired[opponent] = true;
+        Match match;
+        match.round = round;
+        match.bots[0] = order[i];
+        match.bots[1] = order[opponent];
+        matches.push_back(match);
+    }
+    return matches;
+}
+
+static void writeResults(std::ostream &out, const Options &options, const std::vector<Match> &matches, const std::vector<Standing> &standings)
+{
+    for (size_t i=0; i<options.bots.size(); i++) {
+        out << "bot " << i << " " << options.bots[i] << "\n";
+    }
+    for (const Match &match : matches) {
+        out << "match " << match.round << " " << match.bots[0] << " " << match.bots[1] << " "
+            << match.winner << " " << match.reason << " " << match.ticks << "\n";
+    }
+
+    std::vector<int> order;
+    for (size_t i=0; i<standings.size(); i++) {
+        order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const int a, const int b) {
+        return standings[a].rating > standings[b].rating;
+    });
+    for (const int bot : order) {
+        const Standing &standing = standings[bot];
+        out << "rating " << bot << " " << lround(standing.rating) << " " << lround(standing.glicko) << " "
+            << lround(standing.deviation) << " " << standing.points << " "
+            << standing.wins << " " << standing.draws << " " << standing.losses << "\n";
+    }
+}
+
+static void printUsage(const char *name)
+{
+    std::cerr << "Usage: " << name << " [options] <bot command>..." << std::endl;
+    std::cerr << "  --bots <file>      Read bot commands from a file, one per line" << std::endl;
+    std::cerr << "  --swiss            Swiss pairings instead of round-robin" << std::endl;
+    std::cerr << "  --rounds <n>       Rounds for --swiss (default enough to find a winner)" << std::endl;
+    std::cerr << "  --games <n>        Games per pairing in round-robin (default 1)" << std::endl;
+    std::cerr << "  --cores <n>        Cores to use, each match needs three (default all)" << std::endl;
+    std::cerr << "  --port <port>      First port to give the matches (default 4000)" << std::endl;
+    std::cerr << "  --max-ticks <n>    Call it a draw after this many ticks (default 3000)" << std::endl;
+    std::cerr << "  --seed <n>         Seed for the first match, the next get seed + 1 and so on" << std::endl;
+    std::cerr << "  --fast             Step ticks as fast as possible instead of at wall-clock rate" << std::endl;
+    std::cerr << "  --size <w> <h>     Size of the map (default 1280 720)" << std::endl;
+    std::cerr << "  --output <file>    Where to write the results (default stdout)" << std::endl;
+    std::cerr << "  --record <dir>     Record every match there as match-<n>.tgr, for tg18ai-replay" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+
+    for (int i=1; i<argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--bots" && i + 1 < argc) {
+            std::ifstream file(argv[++i]);
+            if (!file) {
+                std::cerr << "Unable to open " << argv[i] << std::endl;
+                return 1;
+            }
+            std::string line;
+            while (std::getline(file, line)) {
+                if (!line.empty() && line[0] != '#') {
+                    options.bots.push_back(line);
+                }
+            }
+        } else if (arg == "--swiss") {
+            options.swiss = true;
+        } else if (arg == "--rounds" && i + 1 < argc) {
+            options.rounds = atoi(argv[++i]);
+        } else if (arg == "--games" && i + 1 < argc) {
+            options.games = std::max(atoi(argv[++i]), 1);
+        } else if (arg == "--cores" && i + 1 < argc) {
+            options.cores = atoi(argv[++i]);
+        } else if (arg == "--port" && i + 1 < argc) {
+            options.port = atoi(argv[++i]);
+        } else if (arg == "--max-ticks" && i + 1 < argc) {
+            options.maxTicks = atol(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "--fast") {
+            options.fast = true;
+        } else if (arg == "--size" && i + 2 < argc) {
+            options.size.x = atoi(argv[++i]);
+            options.size.y = atoi(argv[++i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            options.output = argv[++i];
+        } else if (arg == "--record" && i + 1 < argc) {
+            options.recordDirectory = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        } else {
+            options.bots.push_back(arg);
+        }
+    }
+
+    if (options.bots.size() < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, &sigintHandler);
+    // Bots that exit while we are writing to them
+    signal(SIGPIPE, SIG_IGN);
+
+    // The server thread and the two bots
+    const int cores = options.cores > 0 ? options.cores : std::max(1u, std::thread::hardware_concurrency());
+    const int parallel = std::max(cores / 3, 1);
+    ThreadPool pool(parallel);
+    PortPool ports(options.port, parallel);
+
+    std::vector<Match> matches;
+    std::vector<Standing> standings(options.bots.size());
+
+    if (options.swiss) {
+        int rounds = options.rounds;
+        if (rounds <= 0) {
+            rounds = std::ceil(std::log2(options.bots.size()));
+        }
+        for (int round=0; round<rounds && !s_quit; round++) {
+            const size_t first = matches.size();
+            const std::vector<Match> pairings = swissRound(round, &standings);
+            matches.insert(matches.end(), pairings.begin(), pairings.end());
+            playMatches(options, &matches, first, &pool, &ports);
+            updateStandings(matches, first, &standings);
+        }
+    } else {
+        matches = roundRobin(options);
+        playMatches(options, &matches, 0, &pool, &ports);
+        updateStandings(matches, 0, &standings);
+    }
+
+    if (options.output.empty()) {
+        writeResults(std::cout, options, matches, standings);
+    } else {
+        std::ofstream file(options.output);
+        if (!file) {
+            std::cerr << "Unable to write " << options.output << std::endl;
+            return 1;
+        }
+        writeResults(file, options, matches, standings);
+    }
+
+    return s_quit ? 1 : 0;
+}
@@ -0,0 +1,224 @@
+#include "visibility.h"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+#ifndef M_PI
+#define M_PI		3.14159265358979323846
+#endif
+
+namespace {
+
+struct Event
+{
+    enum Type {
+        End,
+        Crossing,
+        Begin
+    };
+
+    float angle;
+    Type type;
+    int segment;
+    int other;
+
+    bool operator<(const Event &rhs) const {
+        if (angle != rhs.angle) {
+            return angle < rhs.angle;
+        }
+        return type < rhs.type;
+    }
+};
+
+struct SweepState
+{
+    Vec2 center;
+    Vec2 direction;
+    const SegmentBuffer *segments;
+
+    float distance(const int segment) const {
+        return segments->distance(segment, center, direction);
+    }
+};
+
+struct CloserSegment
+{
+    const SweepState *state;
+
+    bool operator()(const int a, const int b) const {
+        return state->distance(a) < state->distance(b);
+    }
+};
+
+typedef multiset<int, CloserSegment> ActiveSet;
+
+// Up to this many segments it is faster to find the nearest one for every
+// interval with SegmentBuffer::nearest() than to keep the active set sorted
+const size_t s_directSegmentLimit = 256;
+
+// Reused between calls, the sweep runs for every player every time something moves
+thread_local vector<Event> t_events;
+thread_local vector<ActiveSet::iterator> t_active;
+thread_local vector<bool> t_isActive;
+
+Vec2 directionFor(const float angle)
+{
+    return Vec2(cos(angle), sin(angle));
+}
+
+}
+
+void computeVisibility(const Vec2 &center,
+                       const SegmentBuffer &segments,
+                       const vector<SegmentCrossing> &crossings,
+                       vector<Vec2> *polygon)
+{
+    polygon->clear();
+    polygon->push_back(center);
+
+    SweepState state;
+    state.center = center;
+    state.segments = &segments;
+    ActiveSet active(CloserSegment{&state});
+
+    vector<Event> &events = t_events;
+    events.clear();
+    t_active.assign(segments.size(), active.end());
+    t_isActive.assign(segments.size(), false);
+
+    // Segments covering the starting angle are active from the beginning
+    vector<int> wrapping;
+
+    for (size_t i=0; i<segments.size(); i++) {
+        const Segment segment = segments.segment(i);
+        const float angleA = atan2(segment.a.y - center.y, segment.a.x - center.x);
+        const float angleB = atan2(segment.b.y - center.y, segment.b.x - center.x);
+
+        float span = angleB - angleA;
+        if (span > M_PI) {
+            span -= 2 * M_PI;
+        } else if (span <= -M_PI) {
+            span += 2 * M_PI;
+        }
+
+        if (span == 0) {
+            // Pointing straight at us, doesn't cover anything
+            continue;
+        }
+
+        const float start = span > 0 ? angleA : angleB;
+        float end = start + fabs(span);
+
+        if (end > M_PI) {
+            end -= 2 * M_PI;
+            wrapping.push_back(i);
+        }
+
+        events.push_back({start, Event::Begin, int(i), -1});
+        events.push_back({end, Event::End, int(i), -1});
+    }
+
+    for (const SegmentCrossing &crossing : crossings) {
+        const float angle = atan2(crossing.point.y - center.y, crossing.point.x - center.x);
+        events.push_back({angle, Event::Crossing, crossing.first, crossing.second});
+    }
+
+    sort(events.begin(), events.end());
+
+    float angle = -M_PI;
+    size_t next = 0;
+
+    const bool direct = segments.size() <= s_directSegmentLimit;
+
+    state.direction = directionFor((angle + (events.empty() ? M_PI : events[0].angle)) / 2);
+    if (!direct) {
+        for (const int segment : wrapping) {
+            t_active[segment] = active.insert(segment);
+            t_isActive[segment] = true;
+        }
+    }
+
+    int previousNearest = -1;
+    vector<int> reinsert;
+
+    while (true) {
+        const float intervalEnd = next < events.size() ? events[next].angle : M_PI;
+
+        // Nothing begins, ends or crosses inside the interval, so whatever
+        // is nearest in the middle of it is nearest all the way
+        int nearest = -1;
+        if (intervalEnd > angle) {
+            if (direct) {
+                segments.nearest(center, directionFor((angle + intervalEnd) / 2), &nearest);
+            } else if (!active.empty()) {
+                nearest = *active.begin();
+            }
+        }
+
+        if (nearest >= 0) {
+            if (nearest != previousNearest) {
+                const Vec2 direction = directionFor(angle);
+                polygon->push_back(center + direction * segments.distance(nearest, center, direction));
+            }
+
+            const Vec2 direction = directionFor(intervalEnd);
+            polygon->push_back(center + direction * segments.distance(nearest, center, direction));
+            previousNearest = nearest;
+        }
+
+        if (next >= events.size()) {
+            break;
+        }
+
+        if (direct) {
+            angle = intervalEnd;
+            next++;
+            continue;
+        }
+
+        // Everything happening at this angle, with the order as it was before it
+        angle = intervalEnd;
+        reinsert.clear();
+        size_t last = next;
+        for (; last < events.size() && events[last].angle == angle; last++) {
+            const Event &event = events[last];
+            if (event.type == Event::End) {
+                if (t_isActive[event.segment]) {
+                    active.erase(t_active[event.segment]);
+                    t_isActive[event.segment] = false;
+                }
+            } else if (event.type == Event::Crossing) {
+                for (const int segment : { event.segment, event.other }) {
+                    if (t_isActive[segment]) {
+                        active.erase(t_active[segment]);
+                        t_isActive[segment] = false;
+                        reinsert.push_back(segment);
+                    }
+                }
+            } else {
+                reinsert.push_back(event.segment);
+            }
+        }
+
+        // And then sorted by how it is after it
+        const float nextAngle = last < events.size() ? events[last].angle : M_PI;
+        state.direction = directionFor((angle + nextAngle) / 2);
+        for (const int segment : reinsert) {
+            if (t_isActive[segment]) {
+                continue;
+            }
+            t_active[segment] = active.insert(segment);
+            t_isActive[segment] = true;
+        }
+
+        next = last;
+    }
+
+    if (polygon->size() < 3) {
+        polygon->clear();
+        return;
+    }
+
+    polygon->push_back((*polygon)[1]); // complete it
+}
@@ -0,0 +1,30 @@
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include "geometry.h"
+#include "segmentbuffer.h"
+
+#include <vector>
+
+using namespace std;
+
+// Computes what is visible from center with an angular sweep over the
+// segment endpoints, keeping the segments under the current ray sorted by
+// distance, so it is O(n log n) instead of casting a ray per angle against
+// every segment.
+//
+// The crossings are where segments intersect each other (overlapping
+// rectangles), the order of the active segments is only valid between them.
+//
+// With few segments the nearest one for each interval between the events is
+// found directly with SegmentBuffer::nearest() instead, which is faster than
+// keeping them sorted.
+//
+// The polygon is a triangle fan: the center, the points in angular order,
+// and then the first point repeated to close it.
+void computeVisibility(const Vec2 &center,
+                       const SegmentBuffer &segments,
+                       const vector<SegmentCrossing> &crossings,
+                       vector<Vec2> *polygon);
+
+#endif // VISIBILITY_H
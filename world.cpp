@@ -0,0 +1,407 @@
+#include "world.h"
+
+#include "player.h"
+#include "snapshot.h"
+#include "replay.h"
+
+#include <algorithm>
+#include <iostream>
+
+static Vec2 clampedSize(const Vec2 &size)
+{
+    if (size.x > World::maxSize || size.y > World::maxSize) {
+        cerr << "World size " << size.x << "x" << size.y << " is too large, limiting to " << World::maxSize << endl;
+    }
+    return Vec2(min(size.x, World::maxSize), min(size.y, World::maxSize));
+}
+
+World::World(const Vec2 &size, const uint32_t seed) :
+    m_size(clampedSize(size)),
+    m_playerStorage(make_shared<deque<Player>>()),
+    m_obstacleGrid(m_size),
+    m_playerGrid(m_size),
+    m_seed(seed),
+    m_random(seed)
+{
+}
+
+World::~World()
+{
+    if (m_recorder) {
+        m_recorder->finish(*this);
+    }
+}
+
+void World::build(const int playerCount)
+{
+    const int width = m_size.x;
+    const int height = m_size.y;
+
+    vector<Rect> rectangles;
+    const int rectCount = m_random.bounded(10) + 5;
+    for (int i=0; i<rectCount; i++) {
+        const int rectWidth = m_random.bounded(200) + 20;
+        const int rectHeight = m_random.bounded(200) + 20;
+        rectangles.push_back(Rect::fromXywh(m_random.bounded(width - rectWidth), m_random.bounded(height - rectHeight), rectWidth, rectHeight));
+    }
+    setRectangles(rectangles);
+
+    for (int i=0; i<playerCount; i++) {
+        addPlayer();
+    }
+    updatePlayerGrid();
+}
+
+shared_ptr<Player> World::addPlayer()
+{
+    m_playerStorage->emplace_back(this);
+    m_players.push_back(shared_ptr<Player>(m_playerStorage, &m_playerStorage->back()));
+    return m_players.back();
+}
+
+void World::addJoiningPlayers()
+{
+    lock_guard<mutex> lock(m_joinMutex);
+    for (const pair<shared_ptr<Connection>, string> &joining : m_joining) {
+        addPlayer()->setTcpConnection(joining.first, joining.second);
+    }
+    m_joining.clear();
+}
+
+void World::setRectangles(const vector<Rect> &rectangles)
+{
+    m_rectangles = rectangles;
+
+    m_obstacleGrid.clear();
+    for (size_t i=0; i<m_rectangles.size(); i++) {
+        m_obstacleGrid.insert(i, m_rectangles[i]);
+    }
+
+    // Horizontal edges first, then vertical, so finding crossings is easy
+    m_segments.clear();
+    vector<Rect> blocks = m_rectangles;
+    blocks.push_back(Rect(Vec2(0, 0), m_size)); // add borders of the map
+    for (const Rect &block : blocks) {
+        m_segments.push_back(Segment(block.tl, Vec2(block.br.x, block.tl.y)));
+        m_segments.push_back(Segment(Vec2(block.tl.x, block.br.y), block.br));
+    }
+    const int verticalStart = m_segments.size();
+    for (const Rect &block : blocks) {
+        m_segments.push_back(Segment(block.tl, Vec2(block.tl.x, block.br.y)));
+        m_segments.push_back(Segment(Vec2(block.br.x, block.tl.y), block.br));
+    }
+
+    m_segmentBuffer.assign(m_segments);
+
+    // Only overlapping rectangles can have edges crossing, the borders never do
+    m_segmentCrossings.clear();
+    for (size_t i=0; i<m_rectangles.size(); i++) {
+        m_obstacleGrid.query(m_rectangles[i], [&](const int other) {
+            if (other == int(i)) {
+                return false;
+            }
+
+            for (int h=0; h<2; h++) {
+                const Segment &horizontal = m_segments[i * 2 + h];
+                for (int v=0; v<2; v++) {
+                    const int verticalIndex = verticalStart + other * 2 + v;
+                    const Segment &vertical = m_segments[verticalIndex];
+
+                    if (vertical.a.x <= horizontal.a.x || vertical.a.x >= horizontal.b.x) {
+                        continue;
+                    }
+                    if (horizontal.a.y <= vertical.a.y || horizontal.a.y >= vertical.b.y) {
+                        continue;
+                    }
+
+                    m_segmentCrossings.push_back({int(i * 2 + h), verticalIndex, Vec2(vertical.a.x, horizontal.a.y)});
+                }
+            }
+            return false;
+        });
+    }
+
+    m_obstacleRevision++;
+}
+
+void World::updatePlayerGrid()
+{
+    m_playerGrid.clear();
+    for (size_t i=0; i<m_players.size(); i++) {
+        if (!m_players[i]->isAlive()) {
+            continue;
+        }
+        m_playerGrid.insert(i, m_players[i]->geometry());
+    }
+}
+
+shared_ptr<Player> World::getPlayerAt(const Vec2 &position)
+{
+    shared_ptr<Player> found;
+    m_playerGrid.queryPoint(position, [&](const int index) {
+        const shared_ptr<Player> &player = m_players[index];
+        if (!found && player->isAlive() && player->geometry().contains(position)) {
+            found = player;
+        }
+    });
+
+    return found;
+}
+
+bool World::onNewClient(std::shared_ptr<Connection> client, const string &initialData)
+{
+    if (!m_running) {
+        return false;
+    }
+
+    lock_guard<mutex> lock(m_joinMutex);
+    for (const shared_ptr<Player> &player : m_players) {
+        if (player->isActive()) {
+            continue;
+        }
+        player->setTcpConnection(client, initialData);
+        return true;
+    }
+
+    if (int(m_players.size() + m_joining.size()) < m_maxPlayers) {
+        m_joining.push_back({ client, initialData });
+        return true;
+    }
+
+    cerr << "Unable to find free player" << endl;
+    return false;
+}
+
+int World::connectedCount() const
+{
+    int count = 0;
+    for (const shared_ptr<Player> &player : m_players) {
+        if (player->isActive()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool World::isInside(const Vec2 &position) const
+{
+    bool inside = false;
+    m_obstacleGrid.queryPoint(position, [&](const int index) {
+        inside = inside || m_rectangles[index].contains(position);
+    });
+
+    return inside;
+}
+
+float World::obstacleHit(const Vec2 &from, const Vec2 &to, const bool startedInside) const
+{
+    if (!startedInside) {
+        // First time we enter any of the rectangles
+        float first = -1;
+        m_obstacleGrid.querySegment(from, to, [&](const int index) {
+            float enter, exit;
+            if (m_rectangles[index].intersects(from, to, &enter, &exit) && (first < 0 || enter < first)) {
+                first = enter;
+            }
+            return false;
+        });
+        return first;
+    }
+
+    // Started inside, so find the first point not covered by any of the rectangles
+    vector<pair<float, float>> covered;
+    m_obstacleGrid.querySegment(from, to, [&](const int index) {
+        float enter, exit;
+        if (m_rectangles[index].intersects(from, to, &enter, &exit)) {
+            covered.push_back({enter, exit});
+        }
+        return false;
+    });
+    sort(covered.begin(), covered.end());
+
+    float reached = 0;
+    for (const pair<float, float> &interval : covered) {
+        if (interval.first > reached) {
+            break;
+        }
+        reached = std::max(reached, interval.second);
+    }
+
+    if (reached >= 1) {
+        return -1;
+    }
+    return reached;
+}
+
+float World::playerHit(const Vec2 &from, const Vec2 &to, const Player *ignore, shared_ptr<Player> *hitPlayer) const
+{
+    float first = -1;
+    m_playerGrid.querySegment(from, to, [&](const int index) {
+        const shared_ptr<Player> &player = m_players[index];
+        if (player.get() == ignore || !player->isAlive()) {
+            return false;
+        }
+
+        float enter, exit;
+        if (!player->geometry().intersects(from, to, &enter, &exit)) {
+            return false;
+        }
+
+        if (first < 0 || enter < first) {
+            first = enter;
+            *hitPlayer = player;
+        }
+        return false;
+    });
+
+    return first;
+}
+
+void World::tick()
+{
+    if (!m_running) {
+        return;
+    }
+
+    ScopedTimer tickTimer(&m_profiler, Profiler::Tick);
+
+    if (m_recorder) {
+        m_recorder->beginTick(*this);
+    }
+
+    m_tickCount++;
+
+    addJoiningPlayers();
+
+    const float dt = chrono::duration<float>(tickInterval).count();
+
+    vector<shared_ptr<Player>> playersAlive;
+    {
+        ScopedTimer timer(&m_profiler, Profiler::Commands);
+        for (const shared_ptr<Player> &player : m_players) {
+            if (!player->isAlive()) {
+                continue;
+            }
+
+            playersAlive.push_back(player);
+
+            player->update();
+        }
+    }
+
+    {
+        ScopedTimer timer(&m_profiler, Profiler::Bullets);
+        updatePlayerGrid();
+
+        // Dead players' bullets are still flying
+        m_bullets.update(this, dt);
+        for (const shared_ptr<Player> &player : m_players) {
+            player->pruneBullets();
+        }
+    }
+
+    playersAlive.erase(remove_if(playersAlive.begin(), playersAlive.end(), [](const shared_ptr<Player> &player) {
+        return !player->isAlive();
+    }), playersAlive.end());
+
+    if (playersAlive.empty()) {
+        std::cout << "no players alive" << std::endl;
+        handleDraw();
+        return;
+    }
+
+    if (playersAlive.size() == 1) {
+        std::cout << "player won" << std::endl;
+        handleWinner(playersAlive[0]);
+        return;
+    }
+
+    {
+        ScopedTimer timer(&m_profiler, Profiler::Visibility);
+        for (const shared_ptr<Player> &player : playersAlive) {
+            player->updateVisibility();
+        }
+    }
+
+    {
+        ScopedTimer timer(&m_profiler, Profiler::Serialization);
+        m_snapshots.push_back(make_shared<const Snapshot>(*this));
+        if (m_snapshots.size() > snapshotHistory) {
+            m_snapshots.pop_front();
+        }
+    }
+
+    ScopedTimer timer(&m_profiler, Profiler::Writes);
+    for (size_t i=0; i<m_players.size(); i++) {
+        m_players[i]->sendUpdate(m_snapshots.back(), i);
+    }
+}
+
+bool World::startRecording(const string &path)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        cerr << "Unable to open " << path << " for recording" << endl;
+        return false;
+    }
+
+    m_recorder = make_unique<ReplayRecorder>(file, *this);
+    return true;
+}
+
+void World::recordCommand(const int playerId, const Command &command)
+{
+    if (m_recorder) {
+        m_recorder->addCommand(playerId, command);
+    }
+}
+
+shared_ptr<const Snapshot> World::lastSnapshot() const
+{
+    if (m_snapshots.empty()) {
+        return nullptr;
+    }
+    return m_snapshots.back();
+}
+
+shared_ptr<const Snapshot> World::snapshotAt(const long tick) const
+{
+    for (const shared_ptr<const Snapshot> &snapshot : m_snapshots) {
+        if (long(snapshot->tick()) == tick) {
+            return snapshot;
+        }
+    }
+    return nullptr;
+}
+
+void World::handleGameOver()
+{
+    m_running = false;
+    m_gameOver = true;
+    if (m_recorder) {
+        m_recorder->finish(*this);
+        m_recorder.reset();
+    }
+    for (shared_ptr<Player> player : m_players) {
+        player->closeConnection();
+    }
+}
+
+void World::handleDraw()
+{
+    handleGameOver();
+
+    if (onGameOver) {
+        onGameOver(nullptr);
+    }
+}
+
+void World::handleWinner(shared_ptr<Player> winner)
+{
+    std::cout << winner->name() << " won" << std::endl;
+    handleGameOver();
+
+    if (onGameOver) {
+        onGameOver(winner);
+    }
+}
@@ -0,0 +1,180 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "bulletstore.h"
+#include "connection.h"
+#include "geometry.h"
+#include "profiler.h"
+#include "protocol.h"
+#include "random.h"
+#include "segmentbuffer.h"
+#include "spatialgrid.h"
+
+#include <SimpleJSON/json.hpp>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Player;
+class Snapshot;
+class ReplayRecorder;
+struct Command;
+
+using namespace std;
+using namespace std::chrono_literals;
+
+// The actual game, without anything related to rendering. Both the headless
+// server and the GameWindow viewer drive this by calling tick().
+class World
+{
+public:
+    static constexpr chrono::milliseconds tickInterval = 20ms;
+    static constexpr int defaultPlayerCount = 3;
+
+    // So every position on the map fits in the DELTA protocol
+    static constexpr float maxSize = protocol::maxCoordinate;
+
+    // Everything random in a world comes from its own generator, so worlds
+    // are independent of each other and the same seed gives the same map.
+    // The size is clamped to maxSize.
+    World(const Vec2 &size, const uint32_t seed = Random::randomSeed());
+    ~World();
+
+    void build(const int playerCount = defaultPlayerCount);
+
+    // Clients connecting when all players are taken get a new player, up to
+    // this many in total. 0 means only the players from build().
+    int maxPlayers() const { return m_maxPlayers; }
+    void setMaxPlayers(const int maxPlayers) { m_maxPlayers = maxPlayers; }
+
+    const Vec2 &size() const { return m_size; }
+    uint32_t seed() const { return m_seed; }
+    Random &random() { return m_random; }
+
+    // Where the ticks go, read by STATS and --stats
+    Profiler &profiler() { return m_profiler; }
+    const Profiler &profiler() const { return m_profiler; }
+
+    // Ids are per world, so they start from 0 in every match
+    int nextPlayerId() { return m_nextPlayerId++; }
+    int nextBulletId() { return m_nextBulletId++; }
+
+    // Every player's bullets
+    BulletStore &bullets() { return m_bullets; }
+    const BulletStore &bullets() const { return m_bullets; }
+
+    const vector<Rect> &rectangles() const { return m_rectangles; }
+    void setRectangles(const vector<Rect> &rectangles);
+
+    // Edges of the rectangles and the map borders, for visibility
+    const vector<Segment> &segments() const { return m_segments; }
+    const SegmentBuffer &segmentBuffer() const { return m_segmentBuffer; }
+    const vector<SegmentCrossing> &segmentCrossings() const { return m_segmentCrossings; }
+
+    // Bumped whenever the obstacles change or a player moves, respawns or
+    // dies, so visibility is only recomputed when it can have changed.
+    int obstacleRevision() const { return m_obstacleRevision; }
+    int playersRevision() const { return m_playersRevision; }
+    void markPlayersChanged() { m_playersRevision++; }
+    const vector<shared_ptr<Player>> &allPlayers() const { return m_players; }
+
+    // What was sent to the bots on the last ticks, for PROTOCOL DELTA
+    static constexpr size_t snapshotHistory = 32;
+    shared_ptr<const Snapshot> lastSnapshot() const;
+    shared_ptr<const Snapshot> snapshotAt(const long tick) const;
+
+    shared_ptr<Player> getPlayerAt(const Vec2 &position);
+
+    // initialData is anything already read from the client, like after a JOIN
+    bool onNewClient(std::shared_ptr<Connection> client, const string &initialData = string());
+    int connectedCount() const;
+
+    bool isInside(const Vec2 &position) const;
+
+    // Swept tests for the segment from -> to, return where along it (0..1)
+    // the hit is, or a negative value if nothing is hit.
+    float obstacleHit(const Vec2 &from, const Vec2 &to, const bool startedInside) const;
+    float playerHit(const Vec2 &from, const Vec2 &to, const Player *ignore, shared_ptr<Player> *hitPlayer) const;
+
+    // Everything possibly overlapping the area, stops early if the callback
+    // returns true. The player grid is rebuilt each tick after the commands
+    // have been applied, so it is as of that point.
+    template<typename Callback>
+    bool queryObstacles(const Rect &area, Callback &&callback) const {
+        return m_obstacleGrid.query(area, [&](const int index) { return callback(m_rectangles[index]); });
+    }
+    template<typename Callback>
+    bool queryPlayers(const Rect &area, Callback &&callback) const {
+        return m_playerGrid.query(area, [&](const int index) { return callback(m_players[index]); });
+    }
+    void updatePlayerGrid();
+
+    void setRunning(const bool running) { m_running = running; }
+    bool isRunning() const { return m_running; }
+    bool isGameOver() const { return m_gameOver; }
+
+    // Advances the game one tickInterval
+    void tick();
+    long tickCount() const { return m_tickCount; }
+
+    // How many queued commands each player gets applied per tick
+    int commandBudget() const { return m_commandBudget; }
+    void setCommandBudget(const int budget) { m_commandBudget = budget; }
+
+    // Records everything applied from now on to path, see replay.h
+    bool startRecording(const string &path);
+    void recordCommand(const int playerId, const Command &command);
+
+    // Winner is null on a draw
+    function<void(shared_ptr<Player> winner)> onGameOver;
+
+private:
+    friend class Replay;
+    friend class ReplayRecorder;
+
+    shared_ptr<Player> addPlayer();
+    void addJoiningPlayers();
+
+    void handleGameOver();
+    void handleDraw();
+    void handleWinner(shared_ptr<Player> winner);
+
+    Vec2 m_size;
+    vector<Rect> m_rectangles;
+    vector<Segment> m_segments;
+    SegmentBuffer m_segmentBuffer;
+    vector<SegmentCrossing> m_segmentCrossings;
+    int m_obstacleRevision = 0;
+    int m_playersRevision = 0;
+    BulletStore m_bullets;
+    vector<shared_ptr<Player>> m_players;
+
+    // The players themselves, in blocks instead of one allocation each. The
+    // handles in m_players share ownership of it.
+    shared_ptr<deque<Player>> m_playerStorage;
+    int m_maxPlayers = 0;
+
+    // Connections waiting for a new player, it is only added between ticks
+    mutable mutex m_joinMutex;
+    vector<pair<shared_ptr<Connection>, string>> m_joining;
+
+    deque<shared_ptr<const Snapshot>> m_snapshots;
+    SpatialGrid m_obstacleGrid;
+    SpatialGrid m_playerGrid;
+    long m_tickCount = 0;
+    int m_commandBudget = 8;
+    uint32_t m_seed;
+    Random m_random;
+    int m_nextPlayerId = 0;
+    int m_nextBulletId = 0;
+    bool m_running = false;
+    bool m_gameOver = false;
+    unique_ptr<ReplayRecorder> m_recorder;
+    Profiler m_profiler;
+};
+
+#endif // WORLD_H